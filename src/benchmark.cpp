@@ -0,0 +1,940 @@
+#include "bsp_tree.hpp"
+#include "camera.hpp"
+#include "frustum.hpp"
+#include "mesh_cache.hpp"
+#include "object.hpp"
+#include "object_bsp_trees.hpp"
+#include "obj_file_parser.hpp"
+#include "polygon.hpp"
+#include "scalar.hpp"
+#include "software_rasterizer.hpp"
+#include <SFML/Graphics/VertexArray.hpp>
+#include <SFML/Graphics/Color.hpp>
+#include <armadillo>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+// every heap allocation made by the program goes through the replaced global
+// operator new below, so the benchmarks can report allocations per iteration
+static std::atomic<std::size_t> allocation_count{0};
+
+void* operator new(std::size_t size)
+{
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size ? size : 1))
+    {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+namespace
+{
+
+struct BenchmarkScene
+{
+    std::string          name;
+    std::vector<Polygon> polygons;
+};
+
+struct Measurement
+{
+    std::size_t iterations;
+    double      nsPerIteration;
+    double      allocationsPerIteration;
+};
+
+// keeps the optimizer from discarding the results of the measured code
+volatile std::size_t benchmark_sink = 0;
+
+Measurement measure(const std::function<void()>& body, double min_seconds)
+{
+    using clock = std::chrono::steady_clock;
+
+    body(); // warm-up, also takes care of lazily initialized state
+
+    std::size_t iterations = 0;
+    auto allocations_before = allocation_count.load();
+    auto start = clock::now();
+    std::chrono::duration<double> elapsed{};
+
+    do
+    {
+        body();
+        ++iterations;
+        elapsed = clock::now() - start;
+    }
+    while (elapsed.count() < min_seconds);
+
+    auto allocations = allocation_count.load() - allocations_before;
+
+    return {
+        iterations,
+        elapsed.count() * 1e9 / iterations,
+        double(allocations) / iterations
+    };
+}
+
+sf::Color randomColor(std::mt19937& rng)
+{
+    return sf::Color(rng(), rng(), rng());
+}
+
+BenchmarkScene loadObjScene(const fs::path& obj_file_path)
+{
+    BenchmarkScene scene;
+    scene.name = obj_file_path.filename().string();
+
+    Object object(obj_file_path);
+    for (std::size_t i = 0; i < object.nPolygons(); ++i)
+    {
+        scene.polygons.push_back(object.getPolygon(i));
+    }
+
+    return scene;
+}
+
+// writes the scene polygons as a Wavefront .obj file, every polygon with its
+// own vertices; returns the size of the file in bytes
+std::size_t writeObjFile(const BenchmarkScene& scene, const fs::path& path)
+{
+    std::ofstream file(path, std::ios::binary);
+    std::size_t n_vertices = 0;
+    char line[128];
+
+    for (const auto& p : scene.polygons)
+    {
+        for (auto i = 0u; i < p.nVertices(); ++i)
+        {
+            auto v = p.getVertex(i);
+            std::snprintf(line, sizeof(line), "v %.9g %.9g %.9g\n",
+                          v[0], v[1], v[2]);
+            file << line;
+        }
+
+        file << 'f';
+        for (auto i = 0u; i < p.nVertices(); ++i)
+        {
+            file << ' ' << ++n_vertices;
+        }
+        file << '\n';
+    }
+
+    return std::size_t(file.tellp());
+}
+
+// small triangles with random positions and orientations inside a cube, a
+// worst case for the BSP tree since almost every plane cuts other triangles
+BenchmarkScene randomTrianglesScene(std::size_t n_triangles, unsigned seed)
+{
+    BenchmarkScene scene;
+    scene.name = "random-triangles-" + std::to_string(n_triangles);
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> position(-10.0, 10.0);
+    std::uniform_real_distribution<double> offset(-0.5, 0.5);
+
+    for (std::size_t i = 0; i < n_triangles; ++i)
+    {
+        arma::vec3 center = {position(rng), position(rng), position(rng)};
+        Polygon triangle;
+        for (int j = 0; j < 3; ++j)
+        {
+            arma::vec3 vertex_offset = {offset(rng), offset(rng), offset(rng)};
+            triangle.addVertex(center + vertex_offset);
+        }
+        triangle.setColor(randomColor(rng));
+        scene.polygons.push_back(triangle);
+    }
+
+    return scene;
+}
+
+// `n` x `n` x `n` unit cubes laid out on a regular grid
+BenchmarkScene cubeGridScene(unsigned n)
+{
+    BenchmarkScene scene;
+    scene.name = "cube-grid-" + std::to_string(n);
+
+    std::mt19937 rng(n);
+    const int faces[6][4] = {
+        {0, 2, 3, 1}, {4, 5, 7, 6}, {0, 1, 5, 4},
+        {2, 6, 7, 3}, {0, 4, 6, 2}, {1, 3, 7, 5}
+    };
+
+    for (unsigned x = 0; x < n; ++x)
+    for (unsigned y = 0; y < n; ++y)
+    for (unsigned z = 0; z < n; ++z)
+    {
+        arma::vec3 corner = {2.0 * x, 2.0 * y, 2.0 * z};
+        for (const auto& face : faces)
+        {
+            Polygon quad;
+            for (int corner_index : face)
+            {
+                arma::vec3 offset = {
+                    double(corner_index & 1),
+                    double((corner_index >> 1) & 1),
+                    double((corner_index >> 2) & 1)
+                };
+                quad.addVertex(corner + offset);
+            }
+            quad.setColor(randomColor(rng));
+            scene.polygons.push_back(quad);
+        }
+    }
+
+    return scene;
+}
+
+void sceneBounds(const std::vector<Polygon>& polygons, arma::vec3& center,
+                 double& radius)
+{
+    arma::vec3 lo = {1e300, 1e300, 1e300};
+    arma::vec3 hi = {-1e300, -1e300, -1e300};
+    for (const auto& p : polygons)
+    {
+        for (auto i = 0u; i < p.nVertices(); ++i)
+        {
+            auto v = p.getVertex(i);
+            for (int k = 0; k < 3; ++k)
+            {
+                lo[k] = std::min(lo[k], v[k]);
+                hi[k] = std::max(hi[k], v[k]);
+            }
+        }
+    }
+
+    center = (lo + hi) / 2.0;
+    radius = std::max(arma::norm(hi - lo) / 2.0, 1.0);
+}
+
+// observer positions on a circle around the scene, used to vary the
+// traversal order between iterations
+std::vector<arma::vec3> orbitPositions(const arma::vec3& center, double radius)
+{
+    std::vector<arma::vec3> positions;
+    for (int i = 0; i < 8; ++i)
+    {
+        double angle = i * 2.0 * 3.14159265358979 / 8;
+        arma::vec3 offset = {
+            2.0 * radius * std::cos(angle),
+            2.0 * radius * std::sin(angle),
+            0.5 * radius
+        };
+        positions.push_back(center + offset);
+    }
+    return positions;
+}
+
+bool samePolygon(const Polygon& a, const Polygon& b)
+{
+    if (a.nVertices() != b.nVertices() || a.getColor() != b.getColor())
+    {
+        return false;
+    }
+
+    for (auto i = 0u; i < a.nVertices(); ++i)
+    {
+        arma::vec3 d = a.getVertex(i) - b.getVertex(i);
+        if (d[0] != 0 || d[1] != 0 || d[2] != 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool sameOrder(const std::vector<const Polygon*>& a,
+               const std::vector<const Polygon*>& b)
+{
+    if (a.size() != b.size())
+    {
+        return false;
+    }
+
+    for (std::size_t i = 0; i < a.size(); ++i)
+    {
+        if (!samePolygon(*a[i], *b[i]))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// pixels where the polygons, drawn in the given order without a depth test,
+// differ from `reference`, the scene drawn with one; pixels a back to front
+// order gets wrong, and a few where polygons touch
+std::size_t paintedMismatches(const std::vector<const Polygon*>& sorted_polygons,
+                              const Camera& camera, const Framebuffer& reference)
+{
+    SoftwareRasterizer::Options options;
+    options.depthTest = false;
+    SoftwareRasterizer painter(options);
+    painter.render(sorted_polygons, camera);
+
+    const auto& pixels = painter.framebuffer().pixels;
+    std::size_t n_mismatches = 0;
+    for (std::size_t i = 0; i < pixels.size(); i += 4)
+    {
+        n_mismatches += !std::equal(pixels.begin() + i, pixels.begin() + i + 3,
+                                    reference.pixels.begin() + i);
+    }
+    return n_mismatches;
+}
+
+// summed over the cameras, the painted mismatches (see above) of the orders
+// given by `sorted_polygons` and of those of `tree`, the reference order;
+// returns a note telling whether the first are no worse than the second
+std::string paintedOrderNote(
+    const std::vector<Polygon>& polygons, const BSPTree& tree,
+    const std::vector<Camera>& cameras,
+    const std::function<std::vector<const Polygon*>(const Camera&)>& sorted_polygons)
+{
+    std::vector<const Polygon*> all_polygons;
+    for (const auto& p : polygons)
+    {
+        all_polygons.push_back(&p);
+    }
+
+    std::size_t n_mismatches = 0;
+    std::size_t n_tree_mismatches = 0;
+    std::size_t n_pixels = 0;
+    SoftwareRasterizer rasterizer;
+    for (const auto& camera : cameras)
+    {
+        rasterizer.render(all_polygons, camera);
+        const auto& reference = rasterizer.framebuffer();
+        n_mismatches += paintedMismatches(sorted_polygons(camera), camera,
+                                          reference);
+        n_tree_mismatches += paintedMismatches(
+            tree.depthSortedPolygons(camera.getPosition(), camera.frustum()),
+            camera, reference);
+        n_pixels += reference.pixels.size() / 4;
+    }
+
+    // both orders are drawn correctly up to ties where polygons touch, which
+    // the orders may break differently
+    bool same = n_mismatches <= n_tree_mismatches + n_pixels / 10000;
+    return "painted-mismatches=" + std::to_string(n_mismatches) + "/"
+           + std::to_string(n_tree_mismatches)
+           + (same ? " matches-full-tree=yes" : " matches-full-tree=NO");
+}
+
+void printHeader()
+{
+    std::printf("geometry precision: %s\n\n",
+                std::is_same_v<Scalar, float> ? "float" : "double");
+    std::printf("%-24s %-28s %10s %10s %14s %14s\n", "stage", "scene",
+                "polygons", "iterations", "ns/polygon", "allocs/iter");
+}
+
+// `note` is printed after the measurements, e.g. for tree statistics
+void printRow(const std::string& stage, const std::string& scene,
+              std::size_t n_polygons, const Measurement& m,
+              const std::string& note = "")
+{
+    double ns_per_polygon = n_polygons ? m.nsPerIteration / n_polygons : 0.0;
+    std::printf("%-24s %-28s %10zu %10zu %14.2f %14.2f  %s\n", stage.c_str(),
+                scene.c_str(), n_polygons, m.iterations, ns_per_polygon,
+                m.allocationsPerIteration, note.c_str());
+    std::fflush(stdout);
+}
+
+void runSceneBenchmarks(const BenchmarkScene& scene, double min_seconds,
+                        const std::string& filter)
+{
+    auto selected = [&](const std::string& stage)
+    {
+        return filter.empty()
+               || (stage + "/" + scene.name).find(filter) != std::string::npos;
+    };
+
+    if (selected("obj-parse"))
+    {
+        auto obj_path = fs::temp_directory_path() 
+                        / "perspective-projection-benchmark.obj";
+        auto n_bytes = writeObjFile(scene, obj_path);
+
+        WavefrontObjFileParser::ParseOptions serial_options;
+        serial_options.parallel = false;
+        WavefrontObjFileParser serial_parser(obj_path);
+        serial_parser.parse(serial_options);
+
+        // small chunks, so that the sample scenes are split too
+        auto parallel_options = serial_options;
+        parallel_options.parallel = true;
+        parallel_options.chunkSize = 1 << 16;
+
+        for (const auto& options : {serial_options, parallel_options})
+        {
+            auto m = measure([&]
+            {
+                WavefrontObjFileParser parser(obj_path);
+                parser.parse(options);
+                benchmark_sink = benchmark_sink + parser.object().nPolygons();
+            }, min_seconds);
+
+            WavefrontObjFileParser parser(obj_path);
+            parser.parse(options);
+            const auto& object = parser.object();
+            const auto& serial_object = serial_parser.object();
+            bool same = object.nPolygons() == serial_object.nPolygons();
+            for (std::size_t i = 0; same && i < object.nPolygons(); ++i)
+            {
+                same = samePolygon(object.getPolygon(i),
+                                   serial_object.getPolygon(i));
+            }
+
+            auto megabytes_per_second = n_bytes / 1e6 
+                                        / (m.nsPerIteration * 1e-9);
+            char note[64];
+            std::snprintf(note, sizeof(note), "%.1f MB/s", megabytes_per_second);
+            std::string stage = "obj-parse";
+            std::string note_text = note;
+            if (options.parallel)
+            {
+                stage += "-par";
+                note_text += same ? " matches-serial=yes" : " matches-serial=NO";
+            }
+            printRow(stage, scene.name, object.nPolygons(), m, note_text);
+        }
+
+        if (writeMeshCache(obj_path, serial_parser.mesh()))
+        {
+            auto m = measure([&]
+            {
+                MeshData mesh;
+                readMeshCache(obj_path, mesh);
+                benchmark_sink = benchmark_sink + mesh.faceColors.size();
+            }, min_seconds);
+            printRow("mesh-cache-read", scene.name, scene.polygons.size(), m);
+            fs::remove(meshCachePath(obj_path));
+        }
+
+        fs::remove(obj_path);
+    }
+
+    arma::vec3 center;
+    double radius;
+    sceneBounds(scene.polygons, center, radius);
+    auto observers = orbitPositions(center, radius);
+
+    struct BuildVariant
+    {
+        const char*                stage;
+        BSPTree::SplitterSelection splitterSelection;
+        bool                       parallel;
+    };
+
+    const BuildVariant build_variants[] = {
+        {"bsp-build-first", BSPTree::SplitterSelection::FirstPolygon,   false},
+        {"bsp-build-min",   BSPTree::SplitterSelection::MinimizeSplits, false},
+        {"bsp-build-par",   BSPTree::SplitterSelection::MinimizeSplits, true}
+    };
+
+    for (const auto& variant : build_variants)
+    {
+        if (!selected(variant.stage))
+        {
+            continue;
+        }
+
+        BSPTree::BuildOptions options;
+        options.splitterSelection = variant.splitterSelection;
+        options.parallel = variant.parallel;
+        auto m = measure([&]
+        {
+            BSPTree tree(scene.polygons, options);
+        }, min_seconds);
+
+        BSPTree tree(scene.polygons, options);
+        std::string note = "fragments=" + std::to_string(tree.nPolygons())
+                           + " nodes=" + std::to_string(tree.nNodes())
+                           + " depth=" + std::to_string(tree.depth());
+
+        if (variant.parallel)
+        {
+            options.parallel = false;
+            BSPTree serial_tree(scene.polygons, options);
+            bool same = sameOrder(tree.depthSortedPolygons(observers.front()),
+                                  serial_tree.depthSortedPolygons(observers.front()));
+            note += same ? " matches-serial=yes" : " matches-serial=NO";
+        }
+
+        printRow(variant.stage, scene.name, scene.polygons.size(), m, note);
+    }
+
+    BSPTree tree(scene.polygons);
+    auto n_fragments = tree.depthSortedPolygons(center).size();
+
+    if (selected("bsp-load"))
+    {
+        auto tree_path = fs::temp_directory_path() 
+                         / "perspective-projection-benchmark.bsp";
+        tree.save(tree_path, scene.polygons);
+
+        auto m = measure([&]
+        {
+            auto loaded = BSPTree::load(tree_path, scene.polygons);
+            benchmark_sink = benchmark_sink + loaded.nPolygons();
+        }, min_seconds);
+
+        auto loaded = BSPTree::load(tree_path, scene.polygons);
+        bool same = sameOrder(loaded.depthSortedPolygons(observers.front()),
+                              tree.depthSortedPolygons(observers.front()));
+        printRow("bsp-load", scene.name, scene.polygons.size(), m,
+                 same ? "matches-built=yes" : "matches-built=NO");
+        fs::remove(tree_path);
+    }
+
+    if (selected("bsp-traverse"))
+    {
+        std::size_t observer_index = 0;
+        auto m = measure([&]
+        {
+            const auto& observer = observers[observer_index++ % observers.size()];
+            benchmark_sink = benchmark_sink + tree.depthSortedPolygons(observer).size();
+        }, min_seconds);
+        printRow("bsp-traverse", scene.name, n_fragments, m);
+    }
+
+    if (selected("bsp-traverse-cull"))
+    {
+        // camera in the middle of the scene looking around, so that only a
+        // part of the scene is in view
+        std::vector<Camera> cameras(observers.size());
+        for (std::size_t i = 0; i < cameras.size(); ++i)
+        {
+            cameras[i].setImageDimensions({1280, 720});
+            cameras[i].setPosition(center);
+            cameras[i].setDirection(observers[i] - center);
+        }
+
+        std::size_t camera_index = 0, n_visible = 0;
+        auto m = measure([&]
+        {
+            const auto& camera = cameras[camera_index++ % cameras.size()];
+            auto visible = tree.depthSortedPolygons(camera.getPosition(),
+                                                    camera.frustum()).size();
+            n_visible += visible;
+            benchmark_sink = benchmark_sink + visible;
+        }, min_seconds);
+
+        auto visible_percentage = 100.0 * n_visible 
+                                  / ((m.iterations + 1) * n_fragments);
+        printRow("bsp-traverse-cull", scene.name, n_fragments, m, 
+                 "visible=" + std::to_string(int(visible_percentage)) + "%");
+    }
+
+    if (selected("bsp-traverse-walk"))
+    {
+        // camera walking through the scene in small steps, looking ahead,
+        // as in an interactive walkthrough; with the cache, only subtrees of
+        // the planes it crosses between frames are sorted again
+        const int n_frames = 1000;
+        std::vector<Camera> cameras(n_frames);
+        arma::vec3 start = observers[0];
+        arma::vec3 end = observers[observers.size() / 2];
+        for (int i = 0; i < n_frames; ++i)
+        {
+            cameras[i].setImageDimensions({1280, 720});
+            cameras[i].setPosition(start + (end - start) * i / (n_frames - 1));
+            cameras[i].setDirection(end - start);
+        }
+
+        BSPTree::TraversalCache check_cache;
+        bool same = true;
+        for (const auto& camera : cameras)
+        {
+            same = same
+                   && tree.depthSortedPolygons(camera.getPosition(),
+                                               camera.frustum(), check_cache)
+                      == tree.depthSortedPolygons(camera.getPosition(),
+                                                  camera.frustum());
+        }
+
+        std::size_t camera_index = 0;
+        auto m = measure([&]
+        {
+            const auto& camera = cameras[camera_index++ % n_frames];
+            benchmark_sink = benchmark_sink
+                             + tree.depthSortedPolygons(camera.getPosition(),
+                                                        camera.frustum()).size();
+        }, min_seconds);
+        printRow("bsp-traverse-walk", scene.name, n_fragments, m);
+
+        BSPTree::TraversalCache cache;
+        std::size_t n_resorted = 0;
+        camera_index = 0;
+        m = measure([&]
+        {
+            const auto& camera = cameras[camera_index++ % n_frames];
+            benchmark_sink = benchmark_sink
+                             + tree.depthSortedPolygons(camera.getPosition(),
+                                                        camera.frustum(),
+                                                        cache).size();
+            n_resorted += cache.nResortedNodes();
+        }, min_seconds);
+
+        auto resorted_percentage = 100.0 * n_resorted
+                                   / ((m.iterations + 1) * tree.nNodes());
+        char note[64];
+        std::snprintf(note, sizeof(note), "resorted=%.1f%% %s",
+                      resorted_percentage,
+                      same ? "matches-uncached=yes" : "matches-uncached=NO");
+        printRow("bsp-traverse-walk-cached", scene.name, n_fragments, m, note);
+    }
+
+    if (selected("bsp-traverse-dynamic"))
+    {
+        // the last 5% of the polygons move, so they are placed in the order
+        // of a tree of the others on every frame instead of being built in
+        auto n_dynamic = std::max<std::size_t>(scene.polygons.size() / 20, 1);
+        auto n_static = scene.polygons.size() - n_dynamic;
+        std::vector<Polygon> static_polygons(scene.polygons.begin(),
+                                             scene.polygons.begin() + n_static);
+        std::vector<Polygon> dynamic_polygons(scene.polygons.begin() + n_static,
+                                              scene.polygons.end());
+        BSPTree static_tree(static_polygons);
+
+        std::vector<Camera> cameras(observers.size());
+        for (std::size_t i = 0; i < cameras.size(); ++i)
+        {
+            cameras[i].setImageDimensions({1280, 720});
+            cameras[i].setPosition(observers[i]);
+            cameras[i].setDirection(center - observers[i]);
+        }
+
+        BSPTree::TraversalCache cache;
+        std::size_t camera_index = 0;
+        auto m = measure([&]
+        {
+            const auto& camera = cameras[camera_index++ % cameras.size()];
+            benchmark_sink = benchmark_sink
+                             + static_tree.depthSortedPolygons(
+                                   camera.getPosition(), camera.frustum(),
+                                   dynamic_polygons, cache).size();
+        }, min_seconds);
+        auto note = paintedOrderNote(scene.polygons, tree, cameras,
+                                     [&](const Camera& camera)
+        {
+            return static_tree.depthSortedPolygons(camera.getPosition(),
+                                                   camera.frustum(),
+                                                   dynamic_polygons, cache);
+        });
+        printRow("bsp-traverse-dynamic", scene.name, n_fragments, m,
+                 "dynamic=" + std::to_string(n_dynamic) + " " + note);
+    }
+
+    if (selected("object-trees-move"))
+    {
+        // the polygons in objects of six, e.g. the cubes of a grid, all of
+        // which move on every frame; only objects whose boxes overlap are
+        // built into a tree again
+        // each object has its first vertex as origin, so that its mesh tree
+        // is traversed for an observer moved into the object's coordinates
+        std::vector<Object> objects;
+        std::vector<arma::vec3> origins;
+        for (std::size_t i = 0; i < scene.polygons.size(); i += 6)
+        {
+            auto& object = objects.emplace_back();
+            origins.push_back(scene.polygons[i].getVertex(0));
+            object.setOrigin(origins.back());
+            auto end = std::min(i + 6, scene.polygons.size());
+            for (auto j = i; j < end; ++j)
+            {
+                object.addPolygon(scene.polygons[j]);
+            }
+        }
+
+        std::vector<Camera> cameras(observers.size());
+        for (std::size_t i = 0; i < cameras.size(); ++i)
+        {
+            cameras[i].setImageDimensions({1280, 720});
+            cameras[i].setPosition(observers[i]);
+            cameras[i].setDirection(center - observers[i]);
+        }
+
+        ObjectBSPTrees trees;
+        std::size_t frame = 0;
+        auto m = measure([&]
+        {
+            arma::vec3 offset = {frame % 2 ? 0.1 : 0.0, 0.0, 0.0};
+            for (std::size_t i = 0; i < objects.size(); ++i)
+            {
+                objects[i].setOrigin(origins[i] + offset);
+                trees.invalidateObject(i);
+            }
+            trees.update(objects);
+
+            const auto& camera = cameras[frame++ % cameras.size()];
+            benchmark_sink = benchmark_sink
+                             + trees.depthSortedPolygons(camera.getPosition(),
+                                                         camera.frustum()).size();
+        }, min_seconds);
+        // back at their origins, the objects have the polygons of the scene
+        // (up to rounding), so `tree` gives the reference order
+        for (std::size_t i = 0; i < objects.size(); ++i)
+        {
+            objects[i].setOrigin(origins[i]);
+            trees.invalidateObject(i);
+        }
+        trees.update(objects);
+        auto note = paintedOrderNote(scene.polygons, tree, cameras,
+                                     [&](const Camera& camera)
+        {
+            return trees.depthSortedPolygons(camera.getPosition(),
+                                             camera.frustum());
+        });
+
+        printRow("object-trees-move", scene.name, scene.polygons.size(), m,
+                 "objects=" + std::to_string(objects.size())
+                 + " merged=" + std::to_string(trees.nMergedObjects())
+                 + " " + note);
+    }
+
+    if (selected("polygon-clip"))
+    {
+        arma::vec3 plane_normal = arma::normalise(arma::vec3{1, 1, 1});
+        auto m = measure([&]
+        {
+            std::size_t n_vertices = 0;
+            for (const auto& p : scene.polygons)
+            {
+                n_vertices += Polygon::clip(p, plane_normal, center).nVertices();
+            }
+            benchmark_sink = benchmark_sink + n_vertices;
+        }, min_seconds);
+        printRow("polygon-clip", scene.name, scene.polygons.size(), m);
+    }
+
+    Camera camera;
+    camera.setImageDimensions({1280, 720});
+    camera.setPosition(observers.front());
+    camera.setDirection(center - observers.front());
+
+    if (selected("camera-project"))
+    {
+        auto m = measure([&]
+        {
+            std::size_t n_vertices = 0;
+            for (const auto& p : scene.polygons)
+            {
+                n_vertices += camera.project(p).getVertexCount();
+            }
+            benchmark_sink = benchmark_sink + n_vertices;
+        }, min_seconds);
+        printRow("camera-project", scene.name, scene.polygons.size(), m);
+    }
+
+    if (selected("camera-batch"))
+    {
+        sf::VertexArray batch(camera.batchPrimitiveType());
+        auto m = measure([&]
+        {
+            batch.clear();
+            for (const auto& p : scene.polygons)
+            {
+                camera.appendProjection(p, p.getColor(), batch);
+            }
+            benchmark_sink = benchmark_sink + batch.getVertexCount();
+        }, min_seconds);
+        printRow("camera-batch", scene.name, scene.polygons.size(), m);
+    }
+
+    if (selected("software-raster"))
+    {
+        std::vector<const Polygon*> polygons;
+        for (const auto& p : scene.polygons)
+        {
+            polygons.push_back(&p);
+        }
+
+        SoftwareRasterizer::Options serial_options;
+        serial_options.parallel = false;
+        SoftwareRasterizer serial(serial_options);
+        serial.render(polygons, camera);
+
+        SoftwareRasterizer rasterizer;
+        auto m = measure([&]
+        {
+            rasterizer.render(polygons, camera);
+            benchmark_sink = benchmark_sink + rasterizer.framebuffer().pixels[0];
+        }, min_seconds);
+
+        const auto& frame = rasterizer.framebuffer();
+        auto n_covered = std::count_if(frame.inverseDepths.begin(),
+                                       frame.inverseDepths.end(),
+                                       [](float d) { return d > 0; });
+        bool same = frame.pixels == serial.framebuffer().pixels
+                    && frame.inverseDepths == serial.framebuffer().inverseDepths;
+        auto covered = "covered="
+                       + std::to_string(100 * n_covered
+                                        / frame.inverseDepths.size())
+                       + "%";
+        printRow("software-raster", scene.name, scene.polygons.size(), m,
+                 covered + (same ? " matches-serial=yes" : " matches-serial=NO"));
+    }
+
+    // every scene vertex in front of the camera, packed as x, y, z triples
+    std::vector<Scalar> points;
+    auto frustum = camera.frustum();
+    for (const auto& p : scene.polygons)
+    {
+        for (auto i = 0u; i < p.nVertices(); ++i)
+        {
+            auto v = p.getVertex(i);
+            if (frustum.planes[0].signedDistance(v) > 0)
+            {
+                points.insert(points.end(), {Scalar(v[0]), Scalar(v[1]),
+                                             Scalar(v[2])});
+            }
+        }
+    }
+    auto n_points = points.size() / 3;
+    std::vector<Scalar> screen_points(2 * n_points);
+
+    if (selected("camera-points"))
+    {
+        auto m = measure([&]
+        {
+            for (std::size_t i = 0; i < n_points; ++i)
+            {
+                auto s = camera.project(arma::vec3{points[3 * i],
+                                                   points[3 * i + 1],
+                                                   points[3 * i + 2]});
+                screen_points[2 * i] = s[0];
+                screen_points[2 * i + 1] = s[1];
+            }
+            benchmark_sink = benchmark_sink + n_points;
+        }, min_seconds);
+        printRow("camera-points", scene.name, n_points, m);
+    }
+
+    if (selected("camera-points-batch"))
+    {
+        auto m = measure([&]
+        {
+            camera.projectPoints(points.data(), n_points, screen_points.data());
+            benchmark_sink = benchmark_sink + n_points;
+        }, min_seconds);
+
+        // largest distance from the one-point-at-a-time projection, in pixels
+        double max_error = 0;
+        for (std::size_t i = 0; i < n_points; ++i)
+        {
+            auto s = camera.project(arma::vec3{points[3 * i],
+                                               points[3 * i + 1],
+                                               points[3 * i + 2]});
+            max_error = std::max({max_error,
+                                  std::abs(s[0] - screen_points[2 * i]),
+                                  std::abs(s[1] - screen_points[2 * i + 1])});
+        }
+
+        char note[64];
+        std::snprintf(note, sizeof(note), "max-error=%.2g px", max_error);
+        printRow("camera-points-batch", scene.name, n_points, m, note);
+    }
+}
+
+void printUsage(const char* program_name)
+{
+    std::cerr << "usage: " << program_name << " [--min-time <seconds>]"
+              << " [--scene-dir <directory>] [--filter <stage/scene>]\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    double min_seconds = 0.25;
+    fs::path scene_dir = "scene";
+    std::string filter;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (i + 1 < argc && arg == "--min-time")
+        {
+            min_seconds = std::atof(argv[++i]);
+        }
+        else if (i + 1 < argc && arg == "--scene-dir")
+        {
+            scene_dir = argv[++i];
+        }
+        else if (i + 1 < argc && arg == "--filter")
+        {
+            filter = argv[++i];
+        }
+        else
+        {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::vector<BenchmarkScene> scenes;
+
+    if (fs::is_directory(scene_dir))
+    {
+        std::vector<fs::path> obj_files;
+        for (const auto& entry : fs::directory_iterator(scene_dir))
+        {
+            if (entry.path().extension() == ".obj")
+            {
+                obj_files.push_back(entry.path());
+            }
+        }
+        std::sort(obj_files.begin(), obj_files.end());
+
+        for (const auto& path : obj_files)
+        {
+            scenes.push_back(loadObjScene(path));
+        }
+    }
+    else
+    {
+        std::cerr << "Scene directory `" << scene_dir.string()
+                  << "` not found, running generated scenes only\n";
+    }
+
+    scenes.push_back(cubeGridScene(8));
+    scenes.push_back(randomTrianglesScene(1000, 1));
+    scenes.push_back(randomTrianglesScene(10000, 2));
+
+    printHeader();
+    for (const auto& scene : scenes)
+    {
+        runSceneBenchmarks(scene, min_seconds, filter);
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+// helpers for the binary files written and read by the renderer (mesh caches,
+// compiled BSP trees)
+
+constexpr std::uint64_t FNV_OFFSET_BASIS = 14695981039346656037ull;
+
+// 64-bit FNV-1a; `hash` is the hash of the preceding data when hashing data
+// in several pieces
+inline std::uint64_t hashBytes(const void* data, std::size_t size,
+                               std::uint64_t hash = FNV_OFFSET_BASIS)
+{
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// reads the `index`-th value of type T from an array starting at `array`,
+// which does not need to be aligned
+template <typename T>
+T readValue(const char* array, std::size_t index)
+{
+    T value;
+    std::memcpy(&value, array + index * sizeof(T), sizeof(T));
+    return value;
+}
+
+template <typename T>
+void writeArray(std::ofstream& file, const std::vector<T>& values)
+{
+    file.write(reinterpret_cast<const char*>(values.data()),
+               values.size() * sizeof(T));
+}
@@ -0,0 +1,26 @@
+#include "bounding_box.hpp"
+#include <armadillo>
+#include <algorithm>
+
+bool BoundingBox::empty() const
+{
+    return min[0] > max[0] || min[1] > max[1] || min[2] > max[2];
+}
+
+void BoundingBox::extend(const arma::vec3 &point)
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        min[i] = std::min(min[i], Scalar(point[i]));
+        max[i] = std::max(max[i], Scalar(point[i]));
+    }
+}
+
+void BoundingBox::extend(const BoundingBox &box)
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        min[i] = std::min(min[i], box.min[i]);
+        max[i] = std::max(max[i], box.max[i]);
+    }
+}
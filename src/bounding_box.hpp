@@ -0,0 +1,25 @@
+#pragma once
+#include "scalar.hpp"
+#include <armadillo>
+#include <limits>
+
+// axis-aligned bounding box; a default constructed box is empty and contains
+// no points
+struct BoundingBox
+{
+    Scalar min[3] = {
+        std::numeric_limits<Scalar>::infinity(),
+        std::numeric_limits<Scalar>::infinity(),
+        std::numeric_limits<Scalar>::infinity()
+    };
+    Scalar max[3] = {
+        -std::numeric_limits<Scalar>::infinity(),
+        -std::numeric_limits<Scalar>::infinity(),
+        -std::numeric_limits<Scalar>::infinity()
+    };
+
+    bool empty() const;
+
+    void extend(const arma::vec3& point);
+    void extend(const BoundingBox& box);
+};
@@ -0,0 +1,170 @@
+#include "bsp_tree.hpp"
+#include "object.hpp"
+#include "polygon.hpp"
+#include "scene.hpp"
+#include <armadillo>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+// Builds the BSP tree of a static scene ahead of time and saves it with
+// BSPTree::save(), so that the renderer can load it with Scene::loadBSPTree()
+// instead of building it at startup. As the build time does not matter here,
+// the splitter of every node is chosen from all of its polygons by default.
+
+namespace fs = std::filesystem;
+
+namespace
+{
+
+struct ObjectSpec
+{
+    fs::path   path;
+    arma::vec3 origin = {0, 0, 0};
+    bool       hasOrigin = false;
+};
+
+// parses `<file.obj>` or `<file.obj>@<x>,<y>,<z>`
+bool parseObjectSpec(const std::string& arg, ObjectSpec& spec)
+{
+    auto at = arg.rfind('@');
+    if (at == std::string::npos)
+    {
+        spec.path = arg;
+        return true;
+    }
+
+    spec.path = arg.substr(0, at);
+    spec.hasOrigin = true;
+    double x, y, z;
+    char end;
+    if (std::sscanf(arg.c_str() + at + 1, "%lf,%lf,%lf%c", &x, &y, &z, &end) != 3)
+    {
+        return false;
+    }
+    spec.origin = {x, y, z};
+    return true;
+}
+
+void printUsage(const char* program_name)
+{
+    std::cerr << "usage: " << program_name << " [--candidates <n>]"
+              << " [--attempts <n>] <output file> <object>...\n"
+              << "\n"
+              << "  <object>          .obj file, optionally followed by"
+              << " @<x>,<y>,<z> to place it\n"
+              << "                    at <x>, <y>, <z>; objects must"
+              << " be given in the order\n"
+              << "                    in which they are added to the scene\n"
+              << "  --candidates <n>  splitter candidates scored per node,"
+              << " 0 for all polygons\n"
+              << "                    (default 0)\n"
+              << "  --attempts <n>    build the tree with <n> candidate"
+              << " samplings and keep the\n"
+              << "                    one with the fewest fragments,"
+              << " together with --candidates\n"
+              << "                    (default 1)\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    BSPTree::BuildOptions options;
+    options.maxCandidates = 0;
+    unsigned int n_attempts = 1;
+    fs::path output_path;
+    std::vector<ObjectSpec> objects;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (i + 1 < argc && arg == "--candidates")
+        {
+            options.maxCandidates = std::strtoul(argv[++i], nullptr, 10);
+        }
+        else if (i + 1 < argc && arg == "--attempts")
+        {
+            n_attempts = std::max(1ul, std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (output_path.empty())
+        {
+            output_path = arg;
+        }
+        else
+        {
+            ObjectSpec spec;
+            if (!parseObjectSpec(arg, spec))
+            {
+                printUsage(argv[0]);
+                return 1;
+            }
+            objects.push_back(spec);
+        }
+    }
+
+    if (objects.empty())
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    // sampling with more candidates than polygons at any node scores all of
+    // them
+    if (options.maxCandidates == 0)
+    {
+        options.maxCandidates = std::numeric_limits<std::size_t>::max();
+    }
+
+    try
+    {
+        Scene scene;
+        for (const auto& spec : objects)
+        {
+            Object object(spec.path);
+            if (spec.hasOrigin)
+            {
+                object.setOrigin(spec.origin);
+            }
+            scene.addObject(std::move(object));
+        }
+        auto polygons = scene.staticPolygons();
+
+        auto start = std::chrono::steady_clock::now();
+        BSPTree best;
+        for (unsigned int attempt = 0; attempt < n_attempts; ++attempt)
+        {
+            options.seed = attempt;
+            BSPTree tree(polygons, options);
+            if (attempt == 0 || tree.nPolygons() < best.nPolygons()
+                || (tree.nPolygons() == best.nPolygons()
+                    && tree.depth() < best.depth()))
+            {
+                best = std::move(tree);
+            }
+        }
+        std::chrono::duration<double> build_time =
+            std::chrono::steady_clock::now() - start;
+
+        best.save(output_path, polygons);
+
+        std::cout << "polygons:  " << polygons.size() << "\n"
+                  << "fragments: " << best.nPolygons() << "\n"
+                  << "nodes:     " << best.nNodes() << "\n"
+                  << "depth:     " << best.depth() << "\n"
+                  << "built in " << build_time.count() << " s, saved to `"
+                  << output_path.string() << "`\n";
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+}
@@ -1,131 +1,1135 @@
 #include "bsp_tree.hpp"
+#include "binary_io.hpp"
+#include "bounding_box.hpp"
+#include "frustum.hpp"
+#include "mapped_file.hpp"
+#include "plane.hpp"
 #include "polygon.hpp"
+#include "task_pool.hpp"
 #include <armadillo>
 #include <vector>
+#include <iterator>
+#include <memory>
+#include <utility>
+#include <random>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <stdexcept>
+#include <string>
+#include <type_traits>
 
-BSPTree::BSPTree(const std::vector<Polygon> &scene_polygons)
+namespace fs = std::filesystem;
+
+namespace
 {
-    rootNode_.polygons = scene_polygons;
-    rootNode_.splitAll();
+    // marks a child link of a Subtree node that refers to the root of one of
+    // the subtrees spawned from it, the remaining bits are the spawned index
+    constexpr std::uint32_t SPAWNED_SUBTREE_BIT = 0x80000000u;
+
+    // cells of dynamic polygons at a node, see BSPTree::TraversalCache
+    constexpr unsigned int  FRONT_CELL = 0;
+    constexpr unsigned int  BACK_CELL = 1;
+    constexpr unsigned int  COPLANAR_CELL = 2;
+    constexpr std::uint32_t NO_CELL = std::numeric_limits<std::uint32_t>::max();
+
+    // what an entry of the cached traversal stack stands for: a subtree, the
+    // polygons at its root node, or a cell of dynamic polygons at the node
+    // (VISIT_CELL + the cell's slot)
+    constexpr std::uint8_t  VISIT_SUBTREE = 0;
+    constexpr std::uint8_t  VISIT_POLYGONS = 1;
+    constexpr std::uint8_t  VISIT_CELL = 2;
+
+    constexpr char          FILE_MAGIC[8] = {'P', 'P', 'B', 'S', 'P', 0, 0, 0};
+    constexpr std::uint32_t FILE_VERSION = 1;
+    constexpr std::uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+    struct FileHeader
+    {
+        char          magic[8];
+        std::uint32_t version;
+        std::uint32_t byteOrderMark;
+        std::uint32_t scalarSize;
+        std::uint32_t reserved;
+
+        // the scene polygons the tree was built from
+        std::uint64_t sourceHash;
+        std::uint64_t nSourcePolygons;
+
+        std::uint64_t nNodes;
+        std::uint64_t nFragments;
+        std::uint64_t nVertices;
+    };
+
+    static_assert(sizeof(FileHeader) == 64, "BSP file header must not be padded");
+}
+
+struct BSPTree::Subtree
+{
+    std::vector<Node>                     nodes;
+    std::vector<Polygon>                  polygons;
+    std::vector<std::unique_ptr<Subtree>> spawned;
+};
+
+BSPTree::BSPTree(const std::vector<Polygon> &scene_polygons) :
+    BSPTree(scene_polygons, BuildOptions{})
+{}
+
+BSPTree::BSPTree(const std::vector<Polygon> &scene_polygons,
+                 const BuildOptions &options)
+{
+    if (scene_polygons.empty())
+    {
+        return;
+    }
+
+    // the fragments remember which scene polygon they were cut from
+    auto polygons = scene_polygons;
+    for (std::size_t i = 0; i < polygons.size(); ++i)
+    {
+        polygons[i].setSourceIndex(static_cast<std::uint32_t>(i));
+    }
+
+    Subtree root;
+    if (options.parallel)
+    {
+        TaskPool::TaskGroup group(TaskPool::global());
+        buildSubtree(std::move(polygons), options, &group, root);
+        group.wait();
+    }
+    else
+    {
+        buildSubtree(std::move(polygons), options, nullptr, root);
+    }
+
+    appendSubtree(root);
+    computeBounds();
+}
+
+void BSPTree::save(const fs::path& file_path,
+                   const std::vector<Polygon>& scene_polygons) const
+{
+    static_assert(std::is_trivially_copyable_v<Node>,
+                  "nodes are written to the file as they are");
+
+    std::vector<std::uint32_t> vertex_offsets = {0};
+    std::vector<std::uint32_t> source_indices;
+    std::vector<Scalar>        coordinates;
+    vertex_offsets.reserve(polygons_.size() + 1);
+    source_indices.reserve(polygons_.size());
+
+    for (const auto& p : polygons_)
+    {
+        coordinates.insert(coordinates.end(), p.coordinates(),
+                           p.coordinates() + 3 * p.nVertices());
+        if (coordinates.size() / 3 > std::numeric_limits<std::uint32_t>::max())
+        {
+            throw std::runtime_error("BSP tree is too large to be saved");
+        }
+        vertex_offsets.push_back(coordinates.size() / 3);
+        source_indices.push_back(p.getSourceIndex());
+    }
+
+    FileHeader header = {};
+    std::memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC));
+    header.version = FILE_VERSION;
+    header.byteOrderMark = BYTE_ORDER_MARK;
+    header.scalarSize = sizeof(Scalar);
+    header.sourceHash = hashPolygons(scene_polygons);
+    header.nSourcePolygons = scene_polygons.size();
+    header.nNodes = nodes_.size();
+    header.nFragments = polygons_.size();
+    header.nVertices = coordinates.size() / 3;
+
+    std::ofstream file(file_path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    writeArray(file, nodes_);
+    writeArray(file, vertex_offsets);
+    writeArray(file, source_indices);
+    writeArray(file, coordinates);
+    if (!file.flush())
+    {
+        throw std::runtime_error("File `" + file_path.string() +
+                                 "` cannot be written");
+    }
+}
+
+BSPTree BSPTree::load(const fs::path& file_path,
+                      const std::vector<Polygon>& scene_polygons)
+{
+    auto error = [&file_path](const std::string& reason)
+    {
+        return std::runtime_error("BSP tree file `" + file_path.string() +
+                                  "` " + reason);
+    };
+
+    MappedFile file(file_path);
+    if (file.size() < sizeof(FileHeader))
+    {
+        throw error("is not a BSP tree file");
+    }
+
+    auto header = readValue<FileHeader>(file.data(), 0);
+    if (std::memcmp(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0)
+    {
+        throw error("is not a BSP tree file");
+    }
+    if (header.version != FILE_VERSION)
+    {
+        throw error("has unsupported version " +
+                    std::to_string(header.version));
+    }
+    if (header.byteOrderMark != BYTE_ORDER_MARK
+        || header.scalarSize != sizeof(Scalar))
+    {
+        throw error("was written with a different byte order or geometry "
+                    "precision");
+    }
+    if (header.nSourcePolygons != scene_polygons.size()
+        || header.sourceHash != hashPolygons(scene_polygons))
+    {
+        throw error("was built from different polygons than the scene's");
+    }
+
+    // the counts are bounded by the file size before they are multiplied
+    auto size = file.size();
+    if (header.nNodes > size || header.nFragments > size
+        || header.nVertices > size
+        || size != sizeof(FileHeader) + sizeof(Node) * header.nNodes
+                   + sizeof(std::uint32_t) * (2 * header.nFragments + 1)
+                   + 3 * sizeof(Scalar) * header.nVertices)
+    {
+        throw error("is damaged");
+    }
+
+    const char* nodes = file.data() + sizeof(FileHeader);
+    const char* vertex_offsets = nodes + sizeof(Node) * header.nNodes;
+    const char* source_indices = vertex_offsets 
+                                 + sizeof(std::uint32_t) * (header.nFragments + 1);
+    const char* coordinates = source_indices 
+                              + sizeof(std::uint32_t) * header.nFragments;
+
+    BSPTree tree;
+    tree.nodes_.reserve(header.nNodes);
+    for (std::size_t i = 0; i < header.nNodes; ++i)
+    {
+        auto node = readValue<Node>(nodes, i);
+        if (node.firstPolygon > header.nFragments
+            || node.nPolygons > header.nFragments - node.firstPolygon)
+        {
+            throw error("is damaged");
+        }
+        tree.nodes_.push_back(node);
+    }
+
+    // the children links must form a tree whose preorder is the order of the
+    // nodes, which the traversal relies on
+    std::vector<std::uint32_t> pending;
+    if (!tree.nodes_.empty())
+    {
+        pending.push_back(0);
+    }
+    std::size_t n_visited = 0;
+    while (!pending.empty())
+    {
+        auto index = pending.back();
+        pending.pop_back();
+        if (index != n_visited++)
+        {
+            throw error("is damaged");
+        }
+
+        for (auto child : {tree.nodes_[index].back, tree.nodes_[index].front})
+        {
+            if (child != NO_NODE && child >= header.nNodes)
+            {
+                throw error("is damaged");
+            }
+            else if (child != NO_NODE)
+            {
+                pending.push_back(child);
+            }
+        }
+    }
+    if (n_visited != header.nNodes)
+    {
+        throw error("is damaged");
+    }
+
+    tree.polygons_.reserve(header.nFragments);
+    for (std::size_t i = 0; i < header.nFragments; ++i)
+    {
+        auto begin = readValue<std::uint32_t>(vertex_offsets, i);
+        auto end = readValue<std::uint32_t>(vertex_offsets, i + 1);
+        auto source = readValue<std::uint32_t>(source_indices, i);
+        if (begin > end || end > header.nVertices
+            || source >= scene_polygons.size())
+        {
+            throw error("is damaged");
+        }
+
+        auto& fragment = tree.polygons_.emplace_back();
+        for (auto k = begin; k < end; ++k)
+        {
+            fragment.addVertex({readValue<Scalar>(coordinates, 3 * k),
+                                readValue<Scalar>(coordinates, 3 * k + 1),
+                                readValue<Scalar>(coordinates, 3 * k + 2)});
+        }
+        fragment.setColor(scene_polygons[source].getColor());
+        fragment.setSourceIndex(source);
+    }
+
+    return tree;
+}
+
+void BSPTree::setSourceColors(std::uint32_t first_source,
+                              const std::vector<sf::Color>& colors)
+{
+    for (auto& fragment : polygons_)
+    {
+        auto source = fragment.getSourceIndex();
+        if (source >= first_source && source - first_source < colors.size())
+        {
+            fragment.setColor(colors[source - first_source]);
+        }
+    }
+}
+
+std::size_t BSPTree::nPolygons() const
+{
+    return polygons_.size();
+}
+
+std::size_t BSPTree::nNodes() const
+{
+    return nodes_.size();
+}
+
+std::size_t BSPTree::depth() const
+{
+    if (nodes_.empty())
+    {
+        return 0;
+    }
+
+    std::size_t max_depth = 0;
+    std::vector<std::pair<std::uint32_t, std::size_t>> stack = {{0, 1}};
+
+    while (!stack.empty())
+    {
+        auto [index, node_depth] = stack.back();
+        stack.pop_back();
+        max_depth = std::max(max_depth, node_depth);
+
+        for (auto child : {nodes_[index].front, nodes_[index].back})
+        {
+            if (child != NO_NODE)
+            {
+                stack.emplace_back(child, node_depth + 1);
+            }
+        }
+    }
+
+    return max_depth;
+}
+
+const std::vector<Polygon>& BSPTree::fragments() const
+{
+    return polygons_;
 }
 
 std::vector<const Polygon*> BSPTree::depthSortedPolygons(const arma::vec3 observer_position) const
 {
     std::vector<const Polygon*> sorted_polygons;
-    addPolygonsSortedByObserverPos(sorted_polygons, &rootNode_, observer_position);
+    sorted_polygons.reserve(polygons_.size());
+    addPolygonsSortedByObserverPos(sorted_polygons, nodes_, polygons_, 
+                                   observer_position, nullptr);
+    return sorted_polygons;
+}
+
+void BSPTree::appendDepthSortedPolygons(
+    std::vector<const Polygon*>& sorted_polygons,
+    const arma::vec3 observer_position) const
+{
+    addPolygonsSortedByObserverPos(sorted_polygons, nodes_, polygons_,
+                                   observer_position, nullptr);
+}
+
+std::vector<const Polygon*> BSPTree::depthSortedPolygons(
+    const arma::vec3 observer_position, const Frustum& view_frustum) const
+{
+    std::vector<const Polygon*> sorted_polygons;
+    addPolygonsSortedByObserverPos(sorted_polygons, nodes_, polygons_, 
+                                   observer_position, &view_frustum);
     return sorted_polygons;
 }
 
 void BSPTree::addPolygonsSortedByObserverPos(
     std::vector<const Polygon*>& poly_vec, 
-    const Node* node, 
-    const arma::vec3& observer_pos)
+    const std::vector<Node>& nodes,
+    const std::vector<Polygon>& polygons,
+    const arma::vec3& observer_pos,
+    const Frustum* view_frustum)
 {
-    if (!node)
+    if (nodes.empty())
     {
         return;
     }
-    
-    auto plane_normal = node->polygons.front().normal();
-    auto plane_point = node->polygons.front().getVertex(0);
-    
-    if (arma::dot(observer_pos - plane_point, plane_normal) >= 0)
+
+    // an entry either visits the subtree of `node` or, once both children of
+    // the node are ordered around it, outputs the polygons at `node`;
+    // `planeMask` selects the frustum planes the subtree is not known to lie
+    // entirely inside of
+    struct StackEntry
+    {
+        std::uint32_t node;
+        bool          visited;
+        unsigned int  planeMask;
+    };
+
+    auto all_planes = view_frustum ? view_frustum->allPlanesMask() : 0u;
+    std::vector<StackEntry> stack = {{0, false, all_planes}};
+
+    while (!stack.empty())
+    {
+        auto entry = stack.back();
+        stack.pop_back();
+        const auto& node = nodes[entry.node];
+
+        if (entry.visited)
+        {
+            for (auto i = 0u; i < node.nPolygons; ++i)
+            {
+                poly_vec.push_back(&polygons[node.firstPolygon + i]);
+            }
+            continue;
+        }
+
+        if (entry.planeMask && view_frustum->cull(node.bounds, entry.planeMask))
+        {
+            continue;
+        }
+
+        // the subtree on the observer's side is drawn last, so it is pushed
+        // first
+        bool observer_in_front = node.plane.signedDistance(observer_pos) >= 0;
+        auto near_child = observer_in_front ? node.front : node.back;
+        auto far_child = observer_in_front ? node.back : node.front;
+
+        if (near_child != NO_NODE)
+        {
+            stack.push_back({near_child, false, entry.planeMask});
+        }
+        stack.push_back({entry.node, true, 0});
+        if (far_child != NO_NODE)
+        {
+            stack.push_back({far_child, false, entry.planeMask});
+        }
+    }
+}
+
+void BSPTree::TraversalCache::clear()
+{
+    valid_ = false;
+}
+
+std::size_t BSPTree::TraversalCache::nResortedNodes() const
+{
+    return nResortedNodes_;
+}
+
+std::vector<const Polygon*> BSPTree::depthSortedPolygons(
+    const arma::vec3 observer_position, const Frustum& view_frustum,
+    TraversalCache& cache) const
+{
+    static const std::vector<Polygon> no_dynamic_polygons;
+    return depthSortedPolygons(observer_position, view_frustum,
+                               no_dynamic_polygons, cache);
+}
+
+std::vector<const Polygon*> BSPTree::depthSortedPolygons(
+    const arma::vec3 observer_position, const Frustum& view_frustum,
+    const std::vector<Polygon>& dynamic_polygons,
+    TraversalCache& cache) const
+{
+    std::vector<const Polygon*> sorted_polygons;
+    if (nodes_.empty())
     {
-        addPolygonsSortedByObserverPos(poly_vec, node->back, observer_pos);
-        for (const auto& p : node->polygons)
+        // the dynamic polygons are all in the one cell of an empty tree
+        cache.cells_.resize(std::max<std::size_t>(cache.cells_.size(), 1));
+        cache.cells_[0] = dynamic_polygons;
+        sortCell(cache.cells_[0], observer_position);
+        for (const auto& polygon : cache.cells_[0])
         {
-            poly_vec.push_back(&p);
+            sorted_polygons.push_back(&polygon);
         }
-        addPolygonsSortedByObserverPos(poly_vec, node->front, observer_pos);
+        return sorted_polygons;
     }
-    else
+
+    updateTraversalCache(observer_position, cache);
+    placeDynamicPolygons(dynamic_polygons, observer_position, cache);
+
+    auto add_cell = [&](std::uint32_t node, unsigned int slot)
+    {
+        auto cell = cache.nodeCells_[node][slot];
+        if (cell != NO_CELL)
+        {
+            for (const auto& polygon : cache.cells_[cell])
+            {
+                sorted_polygons.push_back(&polygon);
+            }
+        }
+    };
+
+    // the walk of addPolygonsSortedByObserverPos() with the observer's sides
+    // taken from the cache; `begin` is where the subtree of `node` starts in
+    // the cached order, which is copied as it is for subtrees entirely
+    // inside the frustum. Subtrees holding dynamic polygons are neither
+    // culled by their bounds, which leave those polygons out, nor copied.
+    struct StackEntry
+    {
+        std::uint32_t node;
+        std::uint8_t  visit;
+        unsigned int  planeMask;
+        std::size_t   begin;
+    };
+
+    std::vector<StackEntry> stack = {
+        {0, VISIT_SUBTREE, view_frustum.allPlanesMask(), 0}
+    };
+
+    while (!stack.empty())
+    {
+        auto entry = stack.back();
+        stack.pop_back();
+        const auto& node = nodes_[entry.node];
+
+        if (entry.visit == VISIT_POLYGONS)
+        {
+            for (auto i = 0u; i < node.nPolygons; ++i)
+            {
+                sorted_polygons.push_back(&polygons_[node.firstPolygon + i]);
+            }
+            add_cell(entry.node, COPLANAR_CELL);
+            continue;
+        }
+
+        if (entry.visit != VISIT_SUBTREE)
+        {
+            add_cell(entry.node, entry.visit - VISIT_CELL);
+            continue;
+        }
+
+        bool has_dynamic = cache.hasDynamic_[entry.node];
+
+        if (!has_dynamic && entry.planeMask
+            && view_frustum.cull(node.bounds, entry.planeMask))
+        {
+            continue;
+        }
+
+        if (!has_dynamic && !entry.planeMask)
+        {
+            auto first = cache.order_.begin() + entry.begin;
+            sorted_polygons.insert(sorted_polygons.end(), first,
+                                   first + cache.subtreeSizes_[entry.node]);
+            continue;
+        }
+
+        bool observer_in_front = cache.observerInFront_[entry.node];
+        auto near_child = observer_in_front ? node.front : node.back;
+        auto far_child = observer_in_front ? node.back : node.front;
+        unsigned int near_cell = observer_in_front ? FRONT_CELL : BACK_CELL;
+        unsigned int far_cell = observer_in_front ? BACK_CELL : FRONT_CELL;
+        std::size_t far_size = far_child != NO_NODE
+                               ? cache.subtreeSizes_[far_child] : 0;
+
+        if (near_child != NO_NODE)
+        {
+            stack.push_back({near_child, VISIT_SUBTREE, entry.planeMask,
+                             entry.begin + far_size + node.nPolygons});
+        }
+        else if (has_dynamic)
+        {
+            stack.push_back({entry.node, std::uint8_t(VISIT_CELL + near_cell),
+                             0, 0});
+        }
+        stack.push_back({entry.node, VISIT_POLYGONS, 0, 0});
+        if (far_child != NO_NODE)
+        {
+            stack.push_back({far_child, VISIT_SUBTREE, entry.planeMask,
+                             entry.begin});
+        }
+        else if (has_dynamic)
+        {
+            stack.push_back({entry.node, std::uint8_t(VISIT_CELL + far_cell),
+                             0, 0});
+        }
+    }
+
+    return sorted_polygons;
+}
+
+void BSPTree::placeDynamicPolygons(const std::vector<Polygon>& dynamic_polygons,
+                                   const arma::vec3& observer_pos,
+                                   TraversalCache& cache) const
+{
+    // the cells of the previous call
+    for (auto node : cache.dynamicNodes_)
+    {
+        cache.hasDynamic_[node] = false;
+        cache.nodeCells_[node] = {NO_CELL, NO_CELL, NO_CELL};
+    }
+    cache.dynamicNodes_.clear();
+    cache.nCells_ = 0;
+
+    auto cell = [&](std::uint32_t node, unsigned int slot)
+        -> std::vector<Polygon>&
     {
-        addPolygonsSortedByObserverPos(poly_vec, node->front, observer_pos);
-        for (const auto& p : node->polygons)
+        auto& index = cache.nodeCells_[node][slot];
+        if (index == NO_CELL)
         {
-            poly_vec.push_back(&p);
+            index = std::uint32_t(cache.nCells_++);
+            if (cache.cells_.size() < cache.nCells_)
+            {
+                cache.cells_.emplace_back();
+            }
+            cache.cells_[index].clear();
+        }
+        return cache.cells_[index];
+    };
+
+    // polygons are split the way split() splits them when building
+    std::vector<std::pair<std::uint32_t, Polygon>> stack;
+    for (const auto& polygon : dynamic_polygons)
+    {
+        stack.emplace_back(0, polygon);
+        while (!stack.empty())
+        {
+            auto [index, p] = std::move(stack.back());
+            stack.pop_back();
+            const auto& node = nodes_[index];
+
+            if (!cache.hasDynamic_[index])
+            {
+                cache.hasDynamic_[index] = true;
+                cache.dynamicNodes_.push_back(index);
+            }
+
+            auto side = p.classify(node.plane);
+            if (side == Polygon::Side::Coplanar)
+            {
+                cell(index, COPLANAR_CELL).push_back(std::move(p));
+                continue;
+            }
+
+            auto pass_down = [&](Polygon part, std::uint32_t child,
+                                 unsigned int slot)
+            {
+                if (part.empty())
+                {
+                    return;
+                }
+                if (child == NO_NODE)
+                {
+                    cell(index, slot).push_back(std::move(part));
+                }
+                else
+                {
+                    stack.emplace_back(child, std::move(part));
+                }
+            };
+
+            if (side == Polygon::Side::Front)
+            {
+                pass_down(std::move(p), node.front, FRONT_CELL);
+            }
+            else if (side == Polygon::Side::Back)
+            {
+                pass_down(std::move(p), node.back, BACK_CELL);
+            }
+            else
+            {
+                pass_down(Polygon::clip(p, node.plane), node.front, FRONT_CELL);
+                pass_down(Polygon::clip(p, node.plane.flipped()), node.back,
+                          BACK_CELL);
+            }
+        }
+    }
+
+    // nothing separates the polygons of an empty subtree from each other,
+    // those on a node plane do not hide each other
+    for (auto node : cache.dynamicNodes_)
+    {
+        for (auto slot : {FRONT_CELL, BACK_CELL})
+        {
+            auto index = cache.nodeCells_[node][slot];
+            if (index != NO_CELL)
+            {
+                sortCell(cache.cells_[index], observer_pos);
+            }
         }
-        addPolygonsSortedByObserverPos(poly_vec, node->back, observer_pos);
     }
 }
 
-void BSPTree::Node::split()
+void BSPTree::sortCell(std::vector<Polygon>& polygons,
+                       const arma::vec3& observer_pos)
 {
-    if (polygons.empty())
+    if (polygons.size() < 2)
     {
-        throw std::runtime_error("BSPTree::Node::split() called on empty Node");
+        return;
     }
 
-    if (front || back)
+    BuildOptions options;
+    options.parallel = false;
+    BSPTree tree(polygons, options);
+
+    std::vector<Polygon> sorted_polygons;
+    sorted_polygons.reserve(tree.nPolygons());
+    for (const auto* polygon : tree.depthSortedPolygons(observer_pos))
     {
-        throw std::runtime_error("BSPTree::Node::split() called on Node that "
-                                 "already has children");
+        sorted_polygons.push_back(*polygon);
     }
+    polygons = std::move(sorted_polygons);
+}
+
+void BSPTree::updateTraversalCache(const arma::vec3& observer_pos,
+                                   TraversalCache& cache) const
+{
+    const double observer[3] = {observer_pos[0], observer_pos[1],
+                                observer_pos[2]};
+    bool moved = !std::equal(observer, observer + 3, cache.observer_);
+    std::copy(observer, observer + 3, cache.observer_);
+    cache.nResortedNodes_ = 0;
 
-    if (polygons.size() == 1)
+    if (cache.valid_ && cache.subtreeSizes_.size() == nodes_.size()
+        && cache.order_.size() == polygons_.size())
     {
+        if (!moved)
+        {
+            return;
+        }
+
+        // every subtree keeps its place in the order; the subtree of a node
+        // whose plane the observer crossed is sorted again, otherwise only
+        // the subtrees below it can have changed
+        std::vector<std::pair<std::uint32_t, std::size_t>> stack = {{0, 0}};
+        while (!stack.empty())
+        {
+            auto [index, begin] = stack.back();
+            stack.pop_back();
+            const auto& node = nodes_[index];
+
+            bool observer_in_front = node.plane.signedDistance(observer_pos) >= 0;
+            if (observer_in_front != bool(cache.observerInFront_[index]))
+            {
+                sortCachedSubtree(index, begin, observer_pos, cache);
+                continue;
+            }
+
+            auto near_child = observer_in_front ? node.front : node.back;
+            auto far_child = observer_in_front ? node.back : node.front;
+            std::size_t far_size = far_child != NO_NODE
+                                   ? cache.subtreeSizes_[far_child] : 0;
+
+            if (far_child != NO_NODE)
+            {
+                stack.emplace_back(far_child, begin);
+            }
+            if (near_child != NO_NODE)
+            {
+                stack.emplace_back(near_child,
+                                   begin + far_size + node.nPolygons);
+            }
+        }
         return;
     }
 
-    auto polygons_at_node = std::vector<Polygon>{polygons.front()};
-    front = new Node();
-    back = new Node();
-    
+    // children come after their parent in preorder, so walking the nodes
+    // backwards sizes both children of a node before the node itself
+    cache.subtreeSizes_.resize(nodes_.size());
+    for (auto i = nodes_.size(); i-- > 0;)
+    {
+        const auto& node = nodes_[i];
+        cache.subtreeSizes_[i] = node.nPolygons;
+        for (auto child : {node.front, node.back})
+        {
+            if (child != NO_NODE)
+            {
+                cache.subtreeSizes_[i] += cache.subtreeSizes_[child];
+            }
+        }
+    }
+
+    cache.observerInFront_.resize(nodes_.size());
+    cache.order_.resize(polygons_.size());
+    cache.nodeCells_.assign(nodes_.size(), {NO_CELL, NO_CELL, NO_CELL});
+    cache.hasDynamic_.assign(nodes_.size(), false);
+    cache.dynamicNodes_.clear();
+    cache.valid_ = true;
+    if (!nodes_.empty())
+    {
+        sortCachedSubtree(0, 0, observer_pos, cache);
+    }
+}
+
+void BSPTree::sortCachedSubtree(std::uint32_t root, std::size_t begin,
+                                const arma::vec3& observer_pos,
+                                TraversalCache& cache) const
+{
+    // same walk as addPolygonsSortedByObserverPos() without frustum culling
+    std::vector<std::pair<std::uint32_t, bool>> stack = {{root, false}};
+    auto out = cache.order_.begin() + begin;
+
+    while (!stack.empty())
+    {
+        auto [index, visited] = stack.back();
+        stack.pop_back();
+        const auto& node = nodes_[index];
+
+        if (visited)
+        {
+            for (auto i = 0u; i < node.nPolygons; ++i)
+            {
+                *out++ = &polygons_[node.firstPolygon + i];
+            }
+            continue;
+        }
+
+        bool observer_in_front = node.plane.signedDistance(observer_pos) >= 0;
+        cache.observerInFront_[index] = observer_in_front;
+        ++cache.nResortedNodes_;
+
+        auto near_child = observer_in_front ? node.front : node.back;
+        auto far_child = observer_in_front ? node.back : node.front;
+
+        if (near_child != NO_NODE)
+        {
+            stack.emplace_back(near_child, false);
+        }
+        stack.emplace_back(index, true);
+        if (far_child != NO_NODE)
+        {
+            stack.emplace_back(far_child, false);
+        }
+    }
+}
+
+void BSPTree::computeBounds()
+{
+    // children come after their parent in preorder, so walking the nodes
+    // backwards visits both children of a node before the node itself
+    for (auto i = nodes_.size(); i-- > 0;)
+    {
+        auto& node = nodes_[i];
+        node.bounds = BoundingBox{};
+
+        for (auto j = 0u; j < node.nPolygons; ++j)
+        {
+            const auto& p = polygons_[node.firstPolygon + j];
+            for (auto k = 0u; k < p.nVertices(); ++k)
+            {
+                node.bounds.extend(p.getVertex(k));
+            }
+        }
+
+        for (auto child : {node.front, node.back})
+        {
+            if (child != NO_NODE)
+            {
+                node.bounds.extend(nodes_[child].bounds);
+            }
+        }
+    }
+}
+
+std::uint64_t BSPTree::hashPolygons(const std::vector<Polygon>& polygons)
+{
+    auto hash = FNV_OFFSET_BASIS;
+    for (const auto& p : polygons)
+    {
+        std::uint32_t n_vertices = p.nVertices();
+        hash = hashBytes(&n_vertices, sizeof(n_vertices), hash);
+        hash = hashBytes(p.coordinates(), 3 * sizeof(Scalar) * n_vertices,
+                         hash);
+    }
+    return hash;
+}
+
+std::size_t BSPTree::selectSplitter(const std::vector<Polygon>& polygons,
+                                    const BuildOptions& options)
+{
+    if (options.splitterSelection == SplitterSelection::FirstPolygon
+        || polygons.size() <= 2)
+    {
+        return 0;
+    }
+
+    // candidates are either all polygons or a random sample of them, drawn
+    // with replacement, so a polygon may be scored more than once; the
+    // generator is seeded from `options.seed` and the number of polygons at
+    // the node only, so the choice does not depend on the order in which
+    // nodes are built
+    std::vector<std::size_t> candidates;
+    if (polygons.size() <= options.maxCandidates)
+    {
+        candidates.resize(polygons.size());
+        for (std::size_t i = 0; i < candidates.size(); ++i)
+        {
+            candidates[i] = i;
+        }
+    }
+    else
+    {
+        std::seed_seq seed{options.seed, 
+                           static_cast<unsigned int>(polygons.size())};
+        std::mt19937 rng(seed);
+        std::uniform_int_distribution<std::size_t> index(0, polygons.size() - 1);
+        candidates.resize(options.maxCandidates);
+        for (auto& c : candidates)
+        {
+            c = index(rng);
+        }
+    }
+
+    std::size_t best_index = 0;
+    double best_score = std::numeric_limits<double>::infinity();
+
+    for (auto c : candidates)
+    {
+        // polygons without area (e.g. slivers left by clipping) have no
+        // plane to split by
+        auto plane = polygons[c].plane();
+        if (plane.nx == 0 && plane.ny == 0 && plane.nz == 0)
+        {
+            continue;
+        }
+
+        std::size_t n_front = 0, n_back = 0, n_split = 0;
+
+        for (const auto& p : polygons)
+        {
+            switch (p.classify(plane))
+            {
+            case Polygon::Side::Front:
+                ++n_front;
+                break;
+            case Polygon::Side::Back:
+                ++n_back;
+                break;
+            case Polygon::Side::Spanning:
+                ++n_split;
+                break;
+            case Polygon::Side::Coplanar:
+                break;
+            }
+        }
+
+        double imbalance = std::abs(double(n_front) - double(n_back));
+        double score = options.splitWeight * n_split
+                       + options.balanceWeight * imbalance;
+        if (score < best_score)
+        {
+            best_score = score;
+            best_index = c;
+        }
+    }
+
+    return best_index;
+}
+
+void BSPTree::split(std::vector<Polygon>& polygons,
+                    const BuildOptions& options, Node& node,
+                    std::vector<Polygon>& node_polygons,
+                    std::vector<Polygon>& front_polygons,
+                    std::vector<Polygon>& back_polygons)
+{
+    std::swap(polygons.front(), polygons[selectSplitter(polygons, options)]);
+
+    // the splitter stays first among the polygons at the node
     const auto& splitter = polygons.front();
-    arma::vec3 plane_normal = splitter.normal();
-    arma::vec3 plane_point = splitter.getVertex(0);
+    node_polygons.emplace_back();
+    node.plane = splitter.plane();
+    auto back_plane = node.plane.flipped();
     
     for (auto i = 1u; i < polygons.size(); ++i)
     {
-        const auto& p = polygons[i];
+        auto& p = polygons[i];
 
-        if (p.isCoplanar(splitter))
+        // the same test as in clip(), so that no polygon is clipped away on
+        // both sides of the plane
+        if (p.classify(node.plane) == Polygon::Side::Coplanar)
         {
-            polygons_at_node.push_back(p);
+            node_polygons.push_back(std::move(p));
         }
         else
         {
-            auto front_clipping = Polygon::clip(p, plane_normal, plane_point);
+            auto front_clipping = Polygon::clip(p, node.plane);
             if (!front_clipping.empty())
             {
-                front->polygons.push_back(front_clipping);
+                front_polygons.push_back(std::move(front_clipping));
             }
 
-            auto back_clipping = Polygon::clip(p, -plane_normal, plane_point);
+            auto back_clipping = Polygon::clip(p, back_plane);
             if (!back_clipping.empty())
             {
-                back->polygons.push_back(back_clipping);
+                back_polygons.push_back(std::move(back_clipping));
             }
         }
     }
 
-    polygons = polygons_at_node;
+    node_polygons.front() = std::move(polygons.front());
+}
 
-    if (front->polygons.empty())
+void BSPTree::buildSubtree(std::vector<Polygon> polygons,
+                           const BuildOptions& options,
+                           TaskPool::TaskGroup* group,
+                           Subtree& subtree)
+{
+    // polygons of a node which is yet to be split, and the node whose child
+    // it becomes
+    struct PendingNode
     {
-        delete front;
-        front = nullptr;
-    }
+        std::vector<Polygon> polygons;
+        std::uint32_t        parent;
+        bool                 isFront;
+    };
+
+    std::vector<PendingNode> pending;
+    pending.push_back({std::move(polygons), NO_NODE, false});
 
-    if (back->polygons.empty())
+    while (!pending.empty())
     {
-        delete back;
-        back = nullptr;
+        auto current = std::move(pending.back());
+        pending.pop_back();
+
+        auto index = static_cast<std::uint32_t>(subtree.nodes.size());
+        if (current.parent != NO_NODE)
+        {
+            auto& parent = subtree.nodes[current.parent];
+            (current.isFront ? parent.front : parent.back) = index;
+        }
+
+        std::vector<Polygon> node_polygons, front_polygons, back_polygons;
+        auto& node = subtree.nodes.emplace_back();
+        split(current.polygons, options, node, node_polygons, front_polygons,
+              back_polygons);
+
+        node.firstPolygon = subtree.polygons.size();
+        node.nPolygons = node_polygons.size();
+        std::move(node_polygons.begin(), node_polygons.end(),
+                  std::back_inserter(subtree.polygons));
+
+        // the subtrees share no data after split(), so if both are large the
+        // front one is built by another task while this one continues with
+        // the back one
+        bool spawn_front = group 
+                           && front_polygons.size() >= options.parallelCutoff
+                           && back_polygons.size() >= options.parallelCutoff;
+
+        // front is popped first, so the nodes end up in preorder
+        if (!back_polygons.empty())
+        {
+            pending.push_back({std::move(back_polygons), index, false});
+        }
+
+        if (spawn_front)
+        {
+            auto spawned_index = subtree.spawned.size();
+            auto* spawned = subtree.spawned.emplace_back(
+                std::make_unique<Subtree>()).get();
+            node.front = SPAWNED_SUBTREE_BIT 
+                         | static_cast<std::uint32_t>(spawned_index);
+
+            group->run([front = std::move(front_polygons), &options, group,
+                        spawned]() mutable
+            {
+                buildSubtree(std::move(front), options, group, *spawned);
+            });
+        }
+        else if (!front_polygons.empty())
+        {
+            pending.push_back({std::move(front_polygons), index, true});
+        }
     }
 }
 
-void BSPTree::Node::splitAll()
+void BSPTree::appendSubtree(Subtree& root)
 {
-    split();
-    
-    if (front)
+    std::size_t n_nodes = 0, n_polygons = 0;
+    std::vector<Subtree*> subtrees = {&root};
+    for (std::size_t i = 0; i < subtrees.size(); ++i)
     {
-        front->splitAll();
+        n_nodes += subtrees[i]->nodes.size();
+        n_polygons += subtrees[i]->polygons.size();
+        for (auto& s : subtrees[i]->spawned)
+        {
+            subtrees.push_back(s.get());
+        }
     }
-    
-    if (back)
+
+    nodes_.reserve(nodes_.size() + n_nodes);
+    polygons_.reserve(polygons_.size() + n_polygons);
+
+    // preorder walk through the subtrees, giving the same node order as if
+    // the whole tree was built by a single task
+    struct PendingNode
+    {
+        Subtree*      subtree;
+        std::uint32_t node;
+        std::uint32_t parent;
+        bool          isFront;
+    };
+
+    std::vector<PendingNode> pending = {{&root, 0, NO_NODE, false}};
+
+    auto push_child = [&](Subtree* subtree, std::uint32_t link,
+                          std::uint32_t parent, bool is_front)
+    {
+        if (link == NO_NODE)
+        {
+            return;
+        }
+        else if (link & SPAWNED_SUBTREE_BIT)
+        {
+            auto* spawned = subtree->spawned[link & ~SPAWNED_SUBTREE_BIT].get();
+            pending.push_back({spawned, 0, parent, is_front});
+        }
+        else
+        {
+            pending.push_back({subtree, link, parent, is_front});
+        }
+    };
+
+    while (!pending.empty())
     {
-        back->splitAll();
+        auto current = pending.back();
+        pending.pop_back();
+
+        const auto& source = current.subtree->nodes[current.node];
+        auto index = static_cast<std::uint32_t>(nodes_.size());
+        auto& node = nodes_.emplace_back(source);
+        node.firstPolygon = polygons_.size();
+        node.front = NO_NODE;
+        node.back = NO_NODE;
+
+        auto source_polygons = current.subtree->polygons.begin()
+                               + source.firstPolygon;
+        std::move(source_polygons, source_polygons + source.nPolygons,
+                  std::back_inserter(polygons_));
+
+        if (current.parent != NO_NODE)
+        {
+            auto& parent = nodes_[current.parent];
+            (current.isFront ? parent.front : parent.back) = index;
+        }
+
+        push_child(current.subtree, source.back, index, false);
+        push_child(current.subtree, source.front, index, true);
     }
 }
@@ -1,46 +1,268 @@
 #pragma once
+#include "bounding_box.hpp"
+#include "frustum.hpp"
+#include "plane.hpp"
 #include "polygon.hpp"
+#include "task_pool.hpp"
+#include <SFML/Graphics/Color.hpp>
 #include <armadillo>
+#include <array>
+#include <filesystem>
 #include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
 
 // data structure for the binary space partitioning algorithm
+//
+// A built tree can be saved to a binary file and loaded without building it
+// again, e.g. by perspective-projection-bsp-compiler for static scenes:
+//
+//     header (see bsp_tree.cpp), identifying the scene polygons by a hash
+//         of their vertex positions
+//     Node          nodes[n_nodes], in preorder
+//     std::uint32_t vertexOffsets[n_fragments + 1]
+//     std::uint32_t sourceIndices[n_fragments]
+//     Scalar        coordinates[n_vertices][3]
+//
+// Fragment `i` has the vertices vertexOffsets[i] to vertexOffsets[i + 1] - 1
+// and was cut from scene polygon sourceIndices[i]. Numbers are stored in the
+// byte order and precision of the machine and build which wrote the file.
 class BSPTree
 {
 public:
 
+    // how the splitting plane of each node is chosen
+    enum class SplitterSelection
+    {
+        // plane of the first polygon at the node, the tree shape depends on
+        // the order of the input polygons
+        FirstPolygon,
+
+        // plane of the candidate polygon with the lowest score, where
+        // score = splitWeight * (polygons split by the plane)
+        //       + balanceWeight * |polygons in front - polygons behind|
+        MinimizeSplits
+    };
+
+    struct BuildOptions
+    {
+        SplitterSelection splitterSelection = SplitterSelection::MinimizeSplits;
+
+        // nodes with more polygons than this only score a random sample of
+        // `maxCandidates` splitter candidates
+        std::size_t maxCandidates = 64;
+
+        double splitWeight   = 8.0;
+        double balanceWeight = 1.0;
+
+        // seed for the candidate sampling, the same seed and input always
+        // produce the same tree
+        unsigned int seed = 0;
+
+        // build independent subtrees as tasks of TaskPool::global(); the
+        // resulting tree is the same as the one built on a single thread
+        bool parallel = true;
+
+        // subtrees with fewer polygons than this are built serially
+        std::size_t parallelCutoff = 512;
+    };
+
     BSPTree() = default;
 
     // build BSP tree for the given set of scene polygons
     BSPTree(const std::vector<Polygon>& scene_polygons);
+    BSPTree(const std::vector<Polygon>& scene_polygons,
+            const BuildOptions& options);
+
+    // number of polygon fragments stored in the tree (polygons split by the
+    // node planes are counted once for each fragment)
+    std::size_t nPolygons() const;
+    std::size_t nNodes() const;
+    std::size_t depth() const;
+
+    // the polygon fragments of the tree, which the results of
+    // depthSortedPolygons() point to
+    const std::vector<Polygon>& fragments() const;
+
+    // writes the tree to a file (see the format above the class),
+    // `scene_polygons` being the polygons it was built from
+    // may throw std::runtime_error if the file cannot be written
+    void save(const std::filesystem::path& file_path,
+              const std::vector<Polygon>& scene_polygons) const;
+
+    // loads a tree written by save() for the same scene polygons, with the
+    // same geometry precision; the fragments take the current colors of the
+    // polygons they were cut from
+    // may throw std::runtime_error if the file cannot be read, is damaged or
+    // was written for different polygons
+    static BSPTree load(const std::filesystem::path& file_path,
+                        const std::vector<Polygon>& scene_polygons);
+
+    // gives the fragments cut from scene polygons `first_source` to
+    // `first_source + colors.size() - 1` the colors of those polygons, so
+    // that polygons can be recolored without rebuilding the tree
+    void setSourceColors(std::uint32_t first_source,
+                         const std::vector<sf::Color>& colors);
 
     // returns a list of pointers to polygons, sorted by depth relative to the
     // observer's position
     std::vector<const Polygon*> depthSortedPolygons(
         const arma::vec3 observer_position) const;
 
+    // appends the polygons sorted as above to `sorted_polygons`
+    void appendDepthSortedPolygons(std::vector<const Polygon*>& sorted_polygons,
+                                   const arma::vec3 observer_position) const;
+
+    // same as above, but leaves out subtrees lying entirely outside of the
+    // view frustum
+    std::vector<const Polygon*> depthSortedPolygons(
+        const arma::vec3 observer_position, const Frustum& view_frustum) const;
+
+    // depth order of all polygons of a tree for the last observer position,
+    // together with the side of the observer at every node; the order only
+    // changes where the observer crosses a splitting plane, so for the next
+    // position only the subtrees of the crossed planes are sorted again
+    class TraversalCache
+    {
+    public:
+
+        // forgets the cached order, e.g. after the tree was rebuilt
+        void clear();
+
+        // nodes whose subtrees were sorted again by the last update, all
+        // nodes when the order was built from scratch
+        std::size_t nResortedNodes() const;
+
+    private:
+
+        friend class BSPTree;
+
+        bool                        valid_ = false;
+        double                      observer_[3] = {};
+        std::vector<std::uint8_t>   observerInFront_; // per node
+        std::vector<std::uint32_t>  subtreeSizes_;    // fragments, per node
+        std::vector<const Polygon*> order_;
+        std::size_t                 nResortedNodes_ = 0;
+
+        // dynamic polygons placed in the tree by the last call, in cells:
+        // the empty front or back child of a node, or the plane of a node;
+        // the polygons of a cell are cells_[nodeCells_[node][slot]]
+        std::vector<std::vector<Polygon>>         cells_;
+        std::size_t                               nCells_ = 0;
+        std::vector<std::array<std::uint32_t, 3>> nodeCells_;   // per node
+        std::vector<std::uint8_t>                 hasDynamic_;  // per node
+        std::vector<std::uint32_t>                dynamicNodes_;
+    };
+
+    // same as above, reusing the order kept in `cache` from the previous call
+    // and updating it for the new observer position; the result is the same
+    // as without the cache
+    // `cache` must be cleared whenever the tree changes
+    std::vector<const Polygon*> depthSortedPolygons(
+        const arma::vec3 observer_position, const Frustum& view_frustum,
+        TraversalCache& cache) const;
+
+    // same, also ordering `dynamic_polygons`, which are not part of the tree,
+    // e.g. those of moving objects, without rebuilding it: each is passed
+    // down the tree, split by the planes it straddles, and drawn with the
+    // empty subtree or node plane it ends up at; dynamic polygons ending up
+    // at the same empty subtree are ordered by a tree of their own. The cost
+    // grows with the number of dynamic polygons rather than the tree size.
+    // The result points to the dynamic fragments, which are kept in `cache`
+    // until the next call.
+    std::vector<const Polygon*> depthSortedPolygons(
+        const arma::vec3 observer_position, const Frustum& view_frustum,
+        const std::vector<Polygon>& dynamic_polygons,
+        TraversalCache& cache) const;
+
 private:
 
+    static constexpr std::uint32_t NO_NODE = 
+        std::numeric_limits<std::uint32_t>::max();
+
+    // nodes are stored in one array in preorder (node, front subtree, back
+    // subtree) and refer to their children and polygons by index
     struct Node
     {
-        std::vector<Polygon> polygons;
-        Node* front = nullptr;
-        Node* back  = nullptr;
-
-        // take the first polygon at node and split all other polygons into
-        // those behind or in front, and add them into corresponding child nodes
-        // (creates children if needed)
-        void split();
-
-        // do split() on all nodes recursively until all polygons are split
-        // essentially builds the BSP tree for all polygons at the current node
-        void splitAll();
+        // splitting plane, taken from the first polygon at the node when the
+        // tree is built
+        Plane         plane;
+
+        // bounds of all polygons in the subtree of the node
+        BoundingBox   bounds;
+
+        // polygons at the node are polygons_[firstPolygon, firstPolygon + 
+        // nPolygons), all of them are coplanar with the splitting plane
+        std::uint32_t firstPolygon = 0;
+        std::uint32_t nPolygons    = 0;
+
+        std::uint32_t front = NO_NODE;
+        std::uint32_t back  = NO_NODE;
     };
 
+    // part of the tree built by a single build task; children too large to
+    // be built serially are built by other tasks into `spawned` subtrees
+    struct Subtree;
+
+    // returns index of the polygon whose plane should split the node holding
+    // `polygons` according to `options`
+    static std::size_t selectSplitter(const std::vector<Polygon>& polygons,
+                                      const BuildOptions& options);
+
+    // take the splitter polygon and split all other polygons into those
+    // behind or in front of it, polygons coplanar with the splitter stay at
+    // `node`
+    static void split(std::vector<Polygon>& polygons, 
+                      const BuildOptions& options, Node& node,
+                      std::vector<Polygon>& node_polygons,
+                      std::vector<Polygon>& front_polygons,
+                      std::vector<Polygon>& back_polygons);
+
+    // builds the subtree of `polygons` without recursion, spawning tasks in
+    // `group` for large children unless `group` is null
+    static void buildSubtree(std::vector<Polygon> polygons,
+                             const BuildOptions& options,
+                             TaskPool::TaskGroup* group,
+                             Subtree& subtree);
+
+    // appends the subtree and all subtrees spawned from it to the tree
+    void appendSubtree(Subtree& subtree);
+
+    void computeBounds();
+
+    // brings the order kept in `cache` up to date for the observer position
+    void updateTraversalCache(const arma::vec3& observer_pos,
+                              TraversalCache& cache) const;
+
+    // filters the dynamic polygons into the cells of the cache and sorts
+    // the polygons of every cell for the observer
+    void placeDynamicPolygons(const std::vector<Polygon>& dynamic_polygons,
+                              const arma::vec3& observer_pos,
+                              TraversalCache& cache) const;
+
+    // orders polygons not separated by any plane of the tree back to front
+    // with a tree of their own
+    static void sortCell(std::vector<Polygon>& polygons,
+                         const arma::vec3& observer_pos);
+
+    // sorts the subtree of `root` for the observer into the cached order,
+    // starting at `begin`, and records the side of the observer at its nodes
+    void sortCachedSubtree(std::uint32_t root, std::size_t begin,
+                           const arma::vec3& observer_pos,
+                           TraversalCache& cache) const;
+
+    // hash of the vertex positions of the polygons, identifying the input of
+    // a saved tree
+    static std::uint64_t hashPolygons(const std::vector<Polygon>& polygons);
+
     static void addPolygonsSortedByObserverPos(
         std::vector<const Polygon*>& poly_vec, 
-        const Node* node,
-        const arma::vec3& observer_pos);
+        const std::vector<Node>& nodes,
+        const std::vector<Polygon>& polygons,
+        const arma::vec3& observer_pos,
+        const Frustum* view_frustum);
 
-    arma::vec3 observerPos_;
-    Node rootNode_;
+    std::vector<Node>    nodes_;
+    std::vector<Polygon> polygons_;
 };
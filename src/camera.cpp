@@ -1,20 +1,163 @@
 #include "camera.hpp"
 #include "polygon.hpp"
+#include "frustum.hpp"
+#include "plane.hpp"
+#include "scalar.hpp"
+#include "small_vector.hpp"
 #include <SFML/Graphics/VertexArray.hpp>
 #include <SFML/Graphics/PrimitiveType.hpp>
+#include <SFML/Graphics/Vertex.hpp>
+#include <SFML/Graphics/Color.hpp>
+#include <SFML/System/Vector2.hpp>
 #include <armadillo>
+#include <array>
+#include <cstddef>
+#include <limits>
 #include <vector>
 
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#include <xmmintrin.h>
+#endif
+
 #define _USE_MATH_DEFINES // for M_PI
 #include <cmath>
 
+namespace
+{
+    // projected polygon vertices, as screen x, y pairs
+    using ScreenPoints =
+            SmallVector<std::array<Scalar, 2>, 2 * Polygon::INLINE_VERTICES>;
+
+#if defined(__AVX__) || defined(__SSE2__)
+    // the vector operations of the projection kernel, on the widest registers
+    // the build targets
+    template <typename T>
+    struct SimdOps;
+#endif
+
+#if defined(__AVX__)
+    template <>
+    struct SimdOps<double>
+    {
+        using Register = __m256d;
+        static constexpr std::size_t WIDTH = 4;
+
+        static Register broadcast(double a) { return _mm256_set1_pd(a); }
+        static Register add(Register a, Register b) { return _mm256_add_pd(a, b); }
+        static Register mul(Register a, Register b) { return _mm256_mul_pd(a, b); }
+        static Register div(Register a, Register b) { return _mm256_div_pd(a, b); }
+
+        // coordinate `c` of WIDTH consecutive x, y, z triples
+        static Register load(const double* p, int c)
+        {
+            return _mm256_set_pd(p[9 + c], p[6 + c], p[3 + c], p[c]);
+        }
+
+        // stores x0 y0 x1 y1 ...
+        static void storeInterleaved(double* out, Register x, Register y)
+        {
+            Register even = _mm256_unpacklo_pd(x, y); // x0 y0 x2 y2
+            Register odd = _mm256_unpackhi_pd(x, y);  // x1 y1 x3 y3
+            _mm256_storeu_pd(out, _mm256_permute2f128_pd(even, odd, 0x20));
+            _mm256_storeu_pd(out + 4, _mm256_permute2f128_pd(even, odd, 0x31));
+        }
+
+        static void store(double* out, Register a) { _mm256_storeu_pd(out, a); }
+    };
+
+    template <>
+    struct SimdOps<float>
+    {
+        using Register = __m256;
+        static constexpr std::size_t WIDTH = 8;
+
+        static Register broadcast(float a) { return _mm256_set1_ps(a); }
+        static Register add(Register a, Register b) { return _mm256_add_ps(a, b); }
+        static Register mul(Register a, Register b) { return _mm256_mul_ps(a, b); }
+        static Register div(Register a, Register b) { return _mm256_div_ps(a, b); }
+
+        static Register load(const float* p, int c)
+        {
+            return _mm256_set_ps(p[21 + c], p[18 + c], p[15 + c], p[12 + c],
+                                 p[9 + c], p[6 + c], p[3 + c], p[c]);
+        }
+
+        static void storeInterleaved(float* out, Register x, Register y)
+        {
+            Register low = _mm256_unpacklo_ps(x, y);  // x0 y0 x1 y1 x4 y4 x5 y5
+            Register high = _mm256_unpackhi_ps(x, y); // x2 y2 x3 y3 x6 y6 x7 y7
+            _mm256_storeu_ps(out, _mm256_permute2f128_ps(low, high, 0x20));
+            _mm256_storeu_ps(out + 8, _mm256_permute2f128_ps(low, high, 0x31));
+        }
+
+        static void store(float* out, Register a) { _mm256_storeu_ps(out, a); }
+    };
+#elif defined(__SSE2__)
+    template <>
+    struct SimdOps<double>
+    {
+        using Register = __m128d;
+        static constexpr std::size_t WIDTH = 2;
+
+        static Register broadcast(double a) { return _mm_set1_pd(a); }
+        static Register add(Register a, Register b) { return _mm_add_pd(a, b); }
+        static Register mul(Register a, Register b) { return _mm_mul_pd(a, b); }
+        static Register div(Register a, Register b) { return _mm_div_pd(a, b); }
+
+        // coordinate `c` of WIDTH consecutive x, y, z triples
+        static Register load(const double* p, int c)
+        {
+            return _mm_set_pd(p[3 + c], p[c]);
+        }
+
+        // stores x0 y0 x1 y1
+        static void storeInterleaved(double* out, Register x, Register y)
+        {
+            _mm_storeu_pd(out, _mm_unpacklo_pd(x, y));
+            _mm_storeu_pd(out + 2, _mm_unpackhi_pd(x, y));
+        }
+
+        static void store(double* out, Register a) { _mm_storeu_pd(out, a); }
+    };
+
+    template <>
+    struct SimdOps<float>
+    {
+        using Register = __m128;
+        static constexpr std::size_t WIDTH = 4;
+
+        static Register broadcast(float a) { return _mm_set1_ps(a); }
+        static Register add(Register a, Register b) { return _mm_add_ps(a, b); }
+        static Register mul(Register a, Register b) { return _mm_mul_ps(a, b); }
+        static Register div(Register a, Register b) { return _mm_div_ps(a, b); }
+
+        static Register load(const float* p, int c)
+        {
+            return _mm_set_ps(p[9 + c], p[6 + c], p[3 + c], p[c]);
+        }
+
+        static void storeInterleaved(float* out, Register x, Register y)
+        {
+            _mm_storeu_ps(out, _mm_unpacklo_ps(x, y));
+            _mm_storeu_ps(out + 4, _mm_unpackhi_ps(x, y));
+        }
+
+        static void store(float* out, Register a) { _mm_storeu_ps(out, a); }
+    };
+#endif
+}
+
 Camera::Camera() :
+    wireframeEnabled_(false),
     imageDims_{800, 600},
     position_{0, 0, 0},
     projPlane_{0.01, 0, 0},
     up_{0, 0, 1},
     horizontalViewAngle_{90.0 / 360 * M_PI},
-    wireframeEnabled_(false)
+    farClippingDistance_{std::numeric_limits<double>::infinity()}
 {
     update();
 }
@@ -64,6 +207,17 @@ void Camera::setNearClippingDistance(double distance)
     update();
 }
 
+double Camera::getFarClippingDistance() const
+{
+    return farClippingDistance_;
+}
+
+void Camera::setFarClippingDistance(double distance)
+{
+    farClippingDistance_ = distance;
+    update();
+}
+
 void Camera::pitch(double angle)
 {
     arma::vec3 U = arma::cross(projPlane_, up_);
@@ -92,6 +246,7 @@ double Camera::getFOV() const
 void Camera::setFOV(double angle)
 {
     horizontalViewAngle_ = angle / 360 * M_PI;
+    update();
 }
 
 void Camera::move(const arma::vec3 &relative_movement)
@@ -118,14 +273,29 @@ bool Camera::isWireframeEnabled() const
     return wireframeEnabled_;
 }
 
+Frustum Camera::frustum() const
+{
+    return frustum_;
+}
+
 arma::vec2 Camera::project(const arma::vec3 &point) const
 {
-    double alpha = arma::dot(projPlane_, projPlane_)
-                   / arma::dot(projPlane_, point - position_);
-    arma::vec3 c = alpha * (point - position_) - projPlane_;
+    double r[3] = {point[0] - position_[0],
+                   point[1] - position_[1],
+                   point[2] - position_[2]};
+    double alpha = projPlaneNorm2_
+                   / (projPlane_[0] * r[0] + projPlane_[1] * r[1]
+                      + projPlane_[2] * r[2]);
+    double c[3] = {alpha * r[0] - projPlane_[0],
+                   alpha * r[1] - projPlane_[1],
+                   alpha * r[2] - projPlane_[2]};
+    double c_u = c[0] * hScreenVec_[0] + c[1] * hScreenVec_[1]
+                 + c[2] * hScreenVec_[2];
+    double c_w = c[0] * vScreenVec_[0] + c[1] * vScreenVec_[1]
+                 + c[2] * vScreenVec_[2];
     arma::vec2 point_projection = {
-        (imageDims_[0] / 2.0) * (1.0 + dot(c, hScreenVec_) / dot(hScreenVec_, hScreenVec_)), 
-        (imageDims_[1] / 2.0) * (1.0 - dot(c, vScreenVec_) / dot(vScreenVec_, vScreenVec_))
+        (imageDims_[0] / 2.0) * (1.0 + c_u * invHScreenNorm2_),
+        (imageDims_[1] / 2.0) * (1.0 - c_w * invVScreenNorm2_)
     };
 
     return point_projection;
@@ -133,7 +303,7 @@ arma::vec2 Camera::project(const arma::vec3 &point) const
 
 sf::VertexArray Camera::project(const Polygon& polygon) const
 {
-    auto clipped_poly = Polygon::clip(polygon, projPlane_, screenCenter_);
+    auto clipped_poly = frustum_.clip(polygon);
     if (clipped_poly.empty())
     {
         return {};
@@ -144,13 +314,15 @@ sf::VertexArray Camera::project(const Polygon& polygon) const
     projection.resize(clipped_poly.nVertices());
     auto poly_color = polygon.getColor();
 
+    ScreenPoints screen_points(clipped_poly.nVertices());
+    projectPoints(clipped_poly.coordinates(), clipped_poly.nVertices(),
+                  screen_points.data()->data());
+
     for (int i = 0; i < projection.getVertexCount(); ++i)
     {
-        auto vertex_projection = project(clipped_poly.getVertex(i));
-        
         projection[i].color = poly_color;
-        projection[i].position.x = vertex_projection[0];
-        projection[i].position.y = vertex_projection[1];
+        projection[i].position.x = screen_points[i][0];
+        projection[i].position.y = screen_points[i][1];
     }
 
     if (wireframeEnabled_)
@@ -166,6 +338,156 @@ sf::VertexArray Camera::project(const Polygon& polygon) const
     return projection;
 }
 
+void Camera::projectPoints(const Scalar* points, std::size_t n_points,
+                           Scalar* screen_points) const
+{
+    projectPoints(points, n_points, screen_points, nullptr);
+}
+
+void Camera::projectPoints(const Scalar* points, std::size_t n_points,
+                           Scalar* screen_points, Scalar* depths) const
+{
+    const auto& m = viewProjection_;
+    std::size_t i = 0;
+
+#if defined(__AVX__) || defined(__SSE2__)
+    using Simd = SimdOps<Scalar>;
+    typename Simd::Register row[3][4];
+    for (int r = 0; r < 3; ++r)
+    {
+        for (int c = 0; c < 4; ++c)
+        {
+            row[r][c] = Simd::broadcast(m[r][c]);
+        }
+    }
+
+    for (; i + Simd::WIDTH <= n_points; i += Simd::WIDTH)
+    {
+        const Scalar* p = points + 3 * i;
+        auto x = Simd::load(p, 0);
+        auto y = Simd::load(p, 1);
+        auto z = Simd::load(p, 2);
+
+        typename Simd::Register h[3];
+        for (int r = 0; r < 3; ++r)
+        {
+            h[r] = Simd::add(Simd::add(Simd::mul(row[r][0], x),
+                                       Simd::mul(row[r][1], y)),
+                             Simd::add(Simd::mul(row[r][2], z), row[r][3]));
+        }
+        Simd::storeInterleaved(screen_points + 2 * i,
+                               Simd::div(h[0], h[2]), Simd::div(h[1], h[2]));
+        if (depths)
+        {
+            Simd::store(depths + i, h[2]);
+        }
+    }
+#endif
+
+    // remaining points, or all of them without SIMD support
+    for (; i < n_points; ++i)
+    {
+        const Scalar* p = points + 3 * i;
+        Scalar h[3];
+        for (int r = 0; r < 3; ++r)
+        {
+            h[r] = (m[r][0] * p[0] + m[r][1] * p[1])
+                   + (m[r][2] * p[2] + m[r][3]);
+        }
+        screen_points[2 * i] = h[0] / h[2];
+        screen_points[2 * i + 1] = h[1] / h[2];
+        if (depths)
+        {
+            depths[i] = h[2];
+        }
+    }
+}
+
+void Camera::appendProjection(const Polygon& polygon, const sf::Color& color,
+                              sf::VertexArray& batch) const
+{
+    auto clipped_poly = frustum_.clip(polygon);
+    auto n_vertices = nProjectionVertices(clipped_poly.nVertices());
+    if (n_vertices == 0)
+    {
+        return;
+    }
+
+    auto offset = batch.getVertexCount();
+    batch.resize(offset + n_vertices);
+    writeProjection(clipped_poly, color, &batch[offset]);
+}
+
+std::size_t Camera::nProjectionVertices(unsigned int n_vertices) const
+{
+    if (n_vertices < 3)
+    {
+        return 0;
+    }
+    return wireframeEnabled_ ? 2 * n_vertices : 3 * (n_vertices - 2);
+}
+
+void Camera::writeProjection(const Polygon& clipped_polygon,
+                             const sf::Color& color, sf::Vertex* out) const
+{
+    auto n = clipped_polygon.nVertices();
+    if (n < 3)
+    {
+        return;
+    }
+
+    ScreenPoints screen_points(n);
+    projectPoints(clipped_polygon.coordinates(), n,
+                  screen_points.data()->data());
+
+    auto projected_vertex = [&](unsigned int index)
+    {
+        const auto& p = screen_points[index];
+        return sf::Vertex(sf::Vector2f(p[0], p[1]), color);
+    };
+
+    // each vertex is converted once, the previous one is carried over to the
+    // next edge or triangle
+    auto first = projected_vertex(0);
+    auto previous = projected_vertex(1);
+
+    if (wireframeEnabled_)
+    {
+        *out++ = first;
+        *out++ = previous;
+    }
+
+    for (auto i = 2u; i < n; ++i)
+    {
+        auto current = projected_vertex(i);
+
+        if (wireframeEnabled_)
+        {
+            *out++ = previous;
+            *out++ = current;
+        }
+        else
+        {
+            *out++ = first;
+            *out++ = previous;
+            *out++ = current;
+        }
+
+        previous = current;
+    }
+
+    if (wireframeEnabled_)
+    {
+        *out++ = previous;
+        *out++ = first;
+    }
+}
+
+sf::PrimitiveType Camera::batchPrimitiveType() const
+{
+    return wireframeEnabled_ ? sf::Lines : sf::Triangles;
+}
+
 arma::vec3 Camera::rotate(const arma::vec3 &vector, const arma::vec3 &axis, double angle)
 {
     angle = angle / M_PI * 180;
@@ -187,4 +509,57 @@ void Camera::update()
     vScreenVec_ = 
             arma::normalise(W) * arma::norm(hScreenVec_)
             * imageDims_[1] / imageDims_[0];
+
+    // plane through the camera position containing the `along` screen axis
+    // and the direction towards the middle of a screen edge, facing inwards
+    auto edge_plane = [this](const arma::vec3& edge_direction, 
+                             const arma::vec3& along)
+    {
+        arma::vec3 normal = arma::normalise(arma::cross(along, edge_direction));
+        if (arma::dot(normal, projPlane_) < 0)
+        {
+            normal = -normal;
+        }
+        return Plane(normal, position_);
+    };
+
+    arma::vec3 direction = arma::normalise(projPlane_);
+    frustum_.planes[0] = Plane(direction, screenCenter_);
+    frustum_.planes[1] = edge_plane(projPlane_ - hScreenVec_, vScreenVec_);
+    frustum_.planes[2] = edge_plane(projPlane_ + hScreenVec_, vScreenVec_);
+    frustum_.planes[3] = edge_plane(projPlane_ - vScreenVec_, hScreenVec_);
+    frustum_.planes[4] = edge_plane(projPlane_ + vScreenVec_, hScreenVec_);
+    frustum_.nPlanes = 5;
+    if (std::isfinite(farClippingDistance_))
+    {
+        arma::vec3 far_point = position_ + farClippingDistance_ * direction;
+        frustum_.planes[5] = Plane(-direction, far_point);
+        frustum_.nPlanes = 6;
+    }
+
+    projPlaneNorm2_ = arma::dot(projPlane_, projPlane_);
+    invHScreenNorm2_ = 1.0 / arma::dot(hScreenVec_, hScreenVec_);
+    invVScreenNorm2_ = 1.0 / arma::dot(vScreenVec_, vScreenVec_);
+
+    // project() written out for a point p, with r = p - b: as u and w are
+    // perpendicular to a, dot(c, u) = dot(a, a) * dot(r, u) / dot(r, a), so
+    // both screen coordinates are ratios of linear functions of p
+    double half_width = imageDims_[0] / 2.0;
+    double half_height = imageDims_[1] / 2.0;
+    arma::vec3 x_row = half_width * projPlane_
+                       + half_width * projPlaneNorm2_ * invHScreenNorm2_
+                         * hScreenVec_;
+    arma::vec3 y_row = half_height * projPlane_
+                       - half_height * projPlaneNorm2_ * invVScreenNorm2_
+                         * vScreenVec_;
+    const arma::vec3* rows[3] = {&x_row, &y_row, &projPlane_};
+
+    for (int i = 0; i < 3; ++i)
+    {
+        for (int j = 0; j < 3; ++j)
+        {
+            viewProjection_[i][j] = (*rows[i])[j];
+        }
+        viewProjection_[i][3] = -arma::dot(*rows[i], position_);
+    }
 }
@@ -1,9 +1,15 @@
 #pragma once
+#include "frustum.hpp"
+#include "scalar.hpp"
+#include <SFML/Graphics/PrimitiveType.hpp>
 #include <armadillo>
+#include <cstddef>
 
 namespace sf
 {
     class VertexArray;
+    class Vertex;
+    class Color;
 }
 
 class Polygon;
@@ -26,6 +32,11 @@ public:
     double getNearClippingDistance() const;
     void   setNearClippingDistance(double distance);
 
+    // polygons are clipped at this distance along the view direction;
+    // infinite (no far clipping) by default
+    double getFarClippingDistance() const;
+    void   setFarClippingDistance(double distance);
+
     void   pitch(double angle);
     void   yaw(double angle);
     void   roll(double angle);
@@ -43,9 +54,45 @@ public:
     void setWireframe(bool enabled);
     bool isWireframeEnabled() const;
 
+    // volume visible to the camera, bounded by the near (and far) clipping
+    // planes and the planes through the camera position and the screen edges;
+    // projected polygons are clipped to it
+    Frustum frustum() const;
+
     arma::vec2      project(const arma::vec3& point) const;
     sf::VertexArray project(const Polygon&) const;
 
+    // projects `n_points` points, given as consecutive x, y, z triples, to
+    // screen coordinates written as consecutive x, y pairs; same results as
+    // project() up to rounding, computed several points at a time with SIMD
+    // instructions when the build targets them (SSE2 or AVX); the points
+    // have to lie in front of the camera, e.g. clipped by the near plane
+    void projectPoints(const Scalar* points, std::size_t n_points,
+                       Scalar* screen_points) const;
+
+    // same, also writing the depth of every point: its distance along the
+    // view direction times the distance of the projection plane from the
+    // camera; the inverse of the depth changes linearly across the screen
+    void projectPoints(const Scalar* points, std::size_t n_points,
+                       Scalar* screen_points, Scalar* depths) const;
+
+    // appends the projection of the polygon, drawn in `color`, to `batch`:
+    // as separate triangles, or as separate edges in wireframe mode, so that
+    // projections of many polygons can share one vertex array whose primitive
+    // type is batchPrimitiveType()
+    void appendProjection(const Polygon&, const sf::Color& color,
+                          sf::VertexArray& batch) const;
+    sf::PrimitiveType batchPrimitiveType() const;
+
+    // the two steps of appendProjection() for a polygon already clipped by
+    // frustum(), so that the projections of many polygons can be written to
+    // their places in a batch independently: the number of vertices the
+    // projection of a polygon with `n_vertices` vertices takes, and writing
+    // them to `out`
+    std::size_t nProjectionVertices(unsigned int n_vertices) const;
+    void        writeProjection(const Polygon& clipped_polygon,
+                                const sf::Color& color, sf::Vertex* out) const;
+
 private:
 
     arma::vec3 rotate(const arma::vec3& vector, const arma::vec3& axis, 
@@ -61,8 +108,19 @@ private:
     arma::vec3  up_;                  // Z
     double      horizontalViewAngle_; // h
     double      verticalViewAngle_;   // v
+    double      farClippingDistance_;
 
     arma::vec3  screenCenter_; // C
     arma::vec3  hScreenVec_;   // u
     arma::vec3  vScreenVec_;   // w
+
+    // derived in update() from the vectors above
+    Frustum frustum_;
+    double projPlaneNorm2_;   // dot(a, a)
+    double invHScreenNorm2_;  // 1 / dot(u, u)
+    double invVScreenNorm2_;  // 1 / dot(w, w)
+
+    // rows giving the screen x, y and depth w of a point p as
+    // dot(row, [p 1]), so that it projects to (x / w, y / w)
+    Scalar viewProjection_[3][4];
 };
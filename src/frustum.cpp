@@ -0,0 +1,92 @@
+#include "frustum.hpp"
+#include "bounding_box.hpp"
+#include "plane.hpp"
+#include "polygon.hpp"
+
+unsigned int Frustum::allPlanesMask() const
+{
+    return (1u << nPlanes) - 1;
+}
+
+bool Frustum::cull(const BoundingBox &box, unsigned int &plane_mask) const
+{
+    if (box.empty())
+    {
+        return true;
+    }
+
+    for (auto i = 0u; i < nPlanes; ++i)
+    {
+        if (!(plane_mask & (1u << i)))
+        {
+            continue;
+        }
+
+        // signed distances of the box corners furthest in front of and
+        // furthest behind the plane
+        const auto& p = planes[i];
+        Scalar max_distance = p.d, min_distance = p.d;
+        const Scalar normal[3] = {p.nx, p.ny, p.nz};
+        for (int k = 0; k < 3; ++k)
+        {
+            bool positive = normal[k] >= 0;
+            max_distance += normal[k] * (positive ? box.max[k] : box.min[k]);
+            min_distance += normal[k] * (positive ? box.min[k] : box.max[k]);
+        }
+
+        if (max_distance < 0)
+        {
+            return true;
+        }
+
+        if (min_distance >= 0)
+        {
+            plane_mask &= ~(1u << i);
+        }
+    }
+
+    return false;
+}
+
+unsigned int Frustum::outcode(Scalar x, Scalar y, Scalar z) const
+{
+    unsigned int code = 0;
+    for (auto i = 0u; i < nPlanes; ++i)
+    {
+        bool outside = planes[i].signedDistance(x, y, z) 
+                       <= Polygon::CLIP_TOLERANCE;
+        code |= unsigned(outside) << i;
+    }
+    return code;
+}
+
+Polygon Frustum::clip(const Polygon &polygon) const
+{
+    // planes every vertex lies outside of, and planes any vertex does
+    unsigned int all_outside = allPlanesMask();
+    unsigned int any_outside = 0;
+    const Scalar* p = polygon.coordinates();
+    for (auto i = 0u; i < polygon.nVertices(); ++i, p += 3)
+    {
+        auto code = outcode(p[0], p[1], p[2]);
+        all_outside &= code;
+        any_outside |= code;
+    }
+
+    if (polygon.empty() || all_outside)
+    {
+        Polygon clipped_polygon;
+        clipped_polygon.setColor(polygon.getColor());
+        return clipped_polygon;
+    }
+
+    Polygon clipped_polygon = polygon;
+    for (auto i = 0u; i < nPlanes && !clipped_polygon.empty(); ++i)
+    {
+        if (any_outside & (1u << i))
+        {
+            clipped_polygon = Polygon::clip(clipped_polygon, planes[i]);
+        }
+    }
+    return clipped_polygon;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include "plane.hpp"
+#include "bounding_box.hpp"
+#include "polygon.hpp"
+#include "scalar.hpp"
+#include <array>
+
+// convex volume bounded by planes whose normals point inside, e.g. the part of
+// space visible to a camera
+struct Frustum
+{
+    static constexpr unsigned int MAX_PLANES = 6;
+
+    std::array<Plane, MAX_PLANES> planes;
+    unsigned int                  nPlanes = 0;
+
+    // mask selecting every plane of the frustum
+    unsigned int allPlanesMask() const;
+
+    // tests the box against the planes selected by `plane_mask`; returns true
+    // if the box lies entirely outside the frustum, otherwise clears the bits
+    // of the planes the box lies entirely inside of, so that boxes contained
+    // in this one can skip them
+    bool cull(const BoundingBox& box, unsigned int& plane_mask) const;
+
+    // bit `i` is set if the point is not inside plane `i`, within the
+    // tolerance Polygon::clip() uses
+    unsigned int outcode(Scalar x, Scalar y, Scalar z) const;
+
+    // returns the part of the polygon inside the frustum, clipped only by the
+    // planes some of its vertices lie outside of; polygons entirely inside or
+    // entirely outside one plane are returned whole or empty without clipping
+    Polygon clip(const Polygon& polygon) const;
+};
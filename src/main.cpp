@@ -15,6 +15,9 @@
 #include <SFML/System/Vector2.hpp>
 #include <random>
 #include <cmath>
+#include <filesystem>
+#include <iostream>
+#include <stdexcept>
 #include <string>
 
 sf::Color randomColor()
@@ -50,11 +53,9 @@ int main()
         auto tetrahedron = Object("scene/tetrahedron.obj");
         for (int i = 0; i < tetrahedron.nPolygons(); ++i)
         {
-            auto poly = tetrahedron.getPolygon(i);
-            poly.setColor(randomColor());
-            tetrahedron.setPolygon(i, poly);
+            tetrahedron.setPolygonColor(i, randomColor());
         }
-        tetrahedron.setOrigin({0, -5, 0});
+        tetrahedron.setOrigin({0, 5, 0});
         scene.addObject(tetrahedron);
     }
 
@@ -62,9 +63,7 @@ int main()
         auto cube = Object("scene/cube.obj");
         for (int i = 0; i < cube.nPolygons(); ++i)
         {
-            auto poly = cube.getPolygon(i);
-            poly.setColor(randomColor());
-            cube.setPolygon(i, poly);
+            cube.setPolygonColor(i, randomColor());
         }
         cube.setOrigin({0, 0, 0});
         scene.addObject(cube);
@@ -74,11 +73,9 @@ int main()
         auto cube = Object("scene/cube.obj");
         for (int i = 0; i < cube.nPolygons(); ++i)
         {
-            auto poly = cube.getPolygon(i);
-            poly.setColor(randomColor());
-            cube.setPolygon(i, poly);
+            cube.setPolygonColor(i, randomColor());
         }
-        cube.setOrigin({0, 2, 0});
+        cube.setOrigin({0, -2, 0});
         scene.addObject(cube);
     }
 
@@ -86,11 +83,9 @@ int main()
         auto cube = Object("scene/cube.obj");
         for (int i = 0; i < cube.nPolygons(); ++i)
         {
-            auto poly = cube.getPolygon(i);
-            poly.setColor(randomColor());
-            cube.setPolygon(i, poly);
+            cube.setPolygonColor(i, randomColor());
         }
-        cube.setOrigin({2, 0, 0});
+        cube.setOrigin({-2, 0, 0});
         scene.addObject(cube);
     }
 
@@ -98,11 +93,9 @@ int main()
         auto cube = Object("scene/cube.obj");
         for (int i = 0; i < cube.nPolygons(); ++i)
         {
-            auto poly = cube.getPolygon(i);
-            poly.setColor(randomColor());
-            cube.setPolygon(i, poly);
+            cube.setPolygonColor(i, randomColor());
         }
-        cube.setOrigin({2, 2, 0});
+        cube.setOrigin({-2, -2, 0});
         scene.addObject(cube);
     }
 
@@ -110,14 +103,27 @@ int main()
         auto cyclic_occlusion = Object("scene/cyclic_occlusion.obj");
         for (int i = 0; i < cyclic_occlusion.nPolygons(); ++i)
         {
-            auto poly = cyclic_occlusion.getPolygon(i);
-            poly.setColor(randomColor());
-            cyclic_occlusion.setPolygon(i, poly);
+            cyclic_occlusion.setPolygonColor(i, randomColor());
         }
-        cyclic_occlusion.setOrigin({0, 4, 0});
+        cyclic_occlusion.setOrigin({0, -4, 0});
         scene.addObject(cyclic_occlusion);
     }
 
+    // tree compiled for this scene by perspective-projection-bsp-compiler, if
+    // there is one, else the tree is built on the first frame
+    const std::filesystem::path compiled_tree = "scene/scene.bsp";
+    if (std::filesystem::exists(compiled_tree))
+    {
+        try
+        {
+            scene.loadBSPTree(compiled_tree);
+        }
+        catch (const std::runtime_error& e)
+        {
+            std::clog << e.what() << ", building the BSP tree instead\n";
+        }
+    }
+
     scene.camera().setPosition({-5, -0.5, 0.5});
     scene.camera().setNearClippingDistance(0.05);
 
@@ -161,6 +167,18 @@ int main()
                 {
                     scene.setColorPolygonsByDrawingOrder(!scene.colorPolygonsByDrawingOrder());
                 }
+                if (event.key.code == sf::Keyboard::Key::C)
+                {
+                    scene.setBackFaceCulling(!scene.backFaceCulling());
+                }
+                if (event.key.code == sf::Keyboard::Key::R)
+                {
+                    scene.setSoftwareRendering(!scene.softwareRendering());
+                }
+                if (event.key.code == sf::Keyboard::Key::T)
+                {
+                    scene.setPerObjectTrees(!scene.perObjectTrees());
+                }
                 break;
             default:
                 mouse_controls.handle(event);
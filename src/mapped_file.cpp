@@ -0,0 +1,81 @@
+#include "mapped_file.hpp"
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MAPPED_FILE_USE_MMAP
+#endif
+
+namespace fs = std::filesystem;
+
+MappedFile::MappedFile(const fs::path &file_path)
+{
+#ifdef MAPPED_FILE_USE_MMAP
+    int fd = ::open(file_path.c_str(), O_RDONLY);
+    if (fd >= 0)
+    {
+        struct stat file_status;
+        if (::fstat(fd, &file_status) == 0)
+        {
+            size_ = file_status.st_size;
+
+            // empty files cannot be mapped, and need not be
+            void* address = size_ ? ::mmap(nullptr, size_, PROT_READ,
+                                           MAP_PRIVATE, fd, 0)
+                                  : MAP_FAILED;
+            if (address != MAP_FAILED)
+            {
+                data_ = static_cast<const char*>(address);
+                mapped_ = true;
+            }
+        }
+        ::close(fd);
+    }
+
+    if (mapped_)
+    {
+        return;
+    }
+#endif
+
+    std::ifstream file(file_path, std::ios::binary);
+    if (!file)
+    {
+        throw std::runtime_error("File `" + file_path.string() +
+                                 "` cannot be opened");
+    }
+
+    buffer_.resize(fs::file_size(file_path));
+    file.read(buffer_.data(), buffer_.size());
+    buffer_.resize(file.gcount());
+    data_ = buffer_.data();
+    size_ = buffer_.size();
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef MAPPED_FILE_USE_MMAP
+    if (mapped_)
+    {
+        ::munmap(const_cast<char*>(data_), size_);
+    }
+#endif
+}
+
+const char* MappedFile::data() const
+{
+    return data_;
+}
+
+std::size_t MappedFile::size() const
+{
+    return size_;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include <cstddef>
+#include <filesystem>
+#include <vector>
+
+// read-only view of the whole contents of a file; memory-mapped on platforms
+// that support it, read into memory otherwise
+class MappedFile
+{
+public:
+
+    // may throw std::runtime_error if the file cannot be opened
+    explicit MappedFile(const std::filesystem::path& file_path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const;
+    std::size_t size() const;
+
+private:
+
+    const char*       data_ = nullptr;
+    std::size_t       size_ = 0;
+    bool              mapped_ = false;
+    std::vector<char> buffer_; // the contents if the file is not mapped
+};
@@ -0,0 +1,179 @@
+#include "mesh_cache.hpp"
+#include "binary_io.hpp"
+#include "mapped_file.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    constexpr char          MAGIC[8] = {'P', 'P', 'M', 'E', 'S', 'H', 0, 0};
+    constexpr std::uint32_t VERSION = 1;
+    constexpr std::uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+    struct Header
+    {
+        char          magic[8];
+        std::uint32_t version;
+        std::uint32_t byteOrderMark;
+
+        // the source file the mesh was read from
+        std::uint64_t sourceSize;
+        std::int64_t  sourceTime;
+        std::uint64_t sourceHash;
+
+        std::uint64_t nVertices;
+        std::uint64_t nFaces;
+        std::uint64_t nFaceIndices;
+    };
+
+    static_assert(sizeof(Header) == 64, "mesh cache header must not be padded");
+
+    std::int64_t modificationTime(const fs::path& path)
+    {
+        return fs::last_write_time(path).time_since_epoch().count();
+    }
+}
+
+fs::path meshCachePath(const fs::path &obj_file_path)
+{
+    auto cache_path = obj_file_path;
+    cache_path += ".meshcache";
+    return cache_path;
+}
+
+bool writeMeshCache(const fs::path &obj_file_path, const MeshData &mesh)
+{
+    Header header = {};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.byteOrderMark = BYTE_ORDER_MARK;
+
+    MappedFile source(obj_file_path);
+    header.sourceSize = source.size();
+    header.sourceTime = modificationTime(obj_file_path);
+    header.sourceHash = hashBytes(source.data(), source.size());
+
+    header.nVertices = mesh.vertices.size();
+    header.nFaces = mesh.faceColors.size();
+    header.nFaceIndices = mesh.faceIndices.size();
+
+    // written under a temporary name first, so that a partially written
+    // cache is never used
+    auto cache_path = meshCachePath(obj_file_path);
+    auto temporary_path = cache_path;
+    temporary_path += ".tmp";
+    {
+        std::ofstream file(temporary_path, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        writeArray(file, mesh.vertices);
+        writeArray(file, mesh.faceOffsets);
+        writeArray(file, mesh.faceIndices);
+        writeArray(file, mesh.faceColors);
+        if (!file.flush())
+        {
+            std::error_code error;
+            fs::remove(temporary_path, error);
+            return false;
+        }
+    }
+
+    std::error_code error;
+    fs::rename(temporary_path, cache_path, error);
+    return !error;
+}
+
+bool readMeshCache(const fs::path &obj_file_path, MeshData &mesh)
+{
+    auto cache_path = meshCachePath(obj_file_path);
+    std::error_code error;
+    if (!fs::is_regular_file(cache_path, error))
+    {
+        return false;
+    }
+
+    MappedFile cache(cache_path);
+    if (cache.size() < sizeof(Header))
+    {
+        return false;
+    }
+
+    auto header = readValue<Header>(cache.data(), 0);
+    if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0
+        || header.version != VERSION
+        || header.byteOrderMark != BYTE_ORDER_MARK)
+    {
+        return false;
+    }
+
+    // the counts are bounded by the file size before they are multiplied
+    auto size = cache.size();
+    if (header.nVertices > size || header.nFaces > size
+        || header.nFaceIndices > size
+        || size != sizeof(Header) + 3 * sizeof(double) * header.nVertices
+                   + sizeof(std::uint32_t) * (2 * header.nFaces + 1
+                                              + header.nFaceIndices))
+    {
+        return false;
+    }
+
+    // the cheap checks of the source first, the hash only if they pass
+    if (header.sourceSize != fs::file_size(obj_file_path)
+        || header.sourceTime != modificationTime(obj_file_path))
+    {
+        return false;
+    }
+
+    MappedFile source(obj_file_path);
+    if (header.sourceHash != hashBytes(source.data(), source.size()))
+    {
+        return false;
+    }
+
+    const char* vertices = cache.data() + sizeof(Header);
+    const char* face_offsets = vertices + 3 * sizeof(double) * header.nVertices;
+    const char* face_indices = face_offsets 
+                               + sizeof(std::uint32_t) * (header.nFaces + 1);
+    const char* face_colors = face_indices 
+                              + sizeof(std::uint32_t) * header.nFaceIndices;
+
+    MeshData loaded;
+    loaded.vertices.resize(header.nVertices);
+    loaded.faceOffsets.resize(header.nFaces + 1);
+    loaded.faceIndices.resize(header.nFaceIndices);
+    loaded.faceColors.resize(header.nFaces);
+    std::memcpy(loaded.vertices.data(), vertices,
+                3 * sizeof(double) * header.nVertices);
+    std::memcpy(loaded.faceOffsets.data(), face_offsets,
+                sizeof(std::uint32_t) * (header.nFaces + 1));
+    std::memcpy(loaded.faceIndices.data(), face_indices,
+                sizeof(std::uint32_t) * header.nFaceIndices);
+    std::memcpy(loaded.faceColors.data(), face_colors,
+                sizeof(std::uint32_t) * header.nFaces);
+
+    if (loaded.faceOffsets.front() != 0
+        || loaded.faceOffsets.back() != header.nFaceIndices
+        || !std::is_sorted(loaded.faceOffsets.begin(), loaded.faceOffsets.end()))
+    {
+        return false;
+    }
+
+    for (auto v_index : loaded.faceIndices)
+    {
+        if (v_index >= header.nVertices)
+        {
+            return false;
+        }
+    }
+
+    mesh = std::move(loaded);
+    return true;
+}
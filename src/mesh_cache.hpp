@@ -0,0 +1,28 @@
+#pragma once
+#include "mesh_data.hpp"
+#include <filesystem>
+
+// The mesh cache of a .obj file is a binary file next to it which holds the
+// mesh in a form that can be loaded without any parsing:
+//
+//     header (see mesh_cache.cpp), identifying the source file by its size,
+//         modification time and hash
+//     double        vertices[n_vertices][3]
+//     std::uint32_t faceOffsets[n_faces + 1]
+//     std::uint32_t faceIndices[n_face_indices]
+//     std::uint32_t faceColors[n_faces]
+//
+// Numbers are stored in the byte order of the machine which wrote the file,
+// caches written on a machine with a different byte order are not used.
+
+std::filesystem::path meshCachePath(const std::filesystem::path& obj_file_path);
+
+// writes the cache of the .obj file, `mesh` being its contents; returns false
+// if the cache could not be written
+bool writeMeshCache(const std::filesystem::path& obj_file_path,
+                    const MeshData& mesh);
+
+// loads the mesh cached for the .obj file into `mesh`; returns false, leaving
+// `mesh` unchanged, if there is no cache or it does not match the current
+// contents of the .obj file
+bool readMeshCache(const std::filesystem::path& obj_file_path, MeshData& mesh);
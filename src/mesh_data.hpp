@@ -0,0 +1,19 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// indexed polygon mesh, e.g. the contents of a .obj file; vertices shared by
+// several faces are stored once
+struct MeshData
+{
+    std::vector<std::array<double, 3>> vertices;
+
+    // face `i` consists of the vertices with the (zero-based) indices
+    // faceIndices[faceOffsets[i]] to faceIndices[faceOffsets[i + 1] - 1]
+    std::vector<std::uint32_t> faceOffsets = {0};
+    std::vector<std::uint32_t> faceIndices;
+
+    // as returned by sf::Color::toInteger()
+    std::vector<std::uint32_t> faceColors;
+};
@@ -0,0 +1,82 @@
+#include "mesh_library.hpp"
+#include "mesh_cache.hpp"
+#include "mesh_data.hpp"
+#include "obj_file_parser.hpp"
+#include <filesystem>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace fs = std::filesystem;
+
+std::shared_ptr<const MeshData> MeshLibrary::get(const fs::path &obj_file_path)
+{
+    // different paths of the same file share the mesh too
+    auto key = fs::weakly_canonical(obj_file_path).string();
+
+    {
+        std::lock_guard lock(mutex_);
+        auto it = meshes_.find(key);
+        if (it != meshes_.end())
+        {
+            if (auto mesh = it->second.lock())
+            {
+                return mesh;
+            }
+        }
+    }
+
+    // loaded without holding the lock, as the parser waits for tasks which
+    // might load meshes themselves; if two threads load the same file, the
+    // mesh loaded first is kept
+    auto loaded = loadMesh(obj_file_path);
+
+    std::lock_guard lock(mutex_);
+    auto it = meshes_.find(key);
+    if (it != meshes_.end())
+    {
+        if (auto mesh = it->second.lock())
+        {
+            return mesh;
+        }
+    }
+
+    // entries of meshes no object uses any more, this one's among them, are
+    // dropped whenever a mesh is loaded, so the map does not keep growing
+    for (it = meshes_.begin(); it != meshes_.end();)
+    {
+        it = it->second.expired() ? meshes_.erase(it) : std::next(it);
+    }
+    meshes_[key] = loaded;
+    return loaded;
+}
+
+MeshLibrary& MeshLibrary::global()
+{
+    static MeshLibrary library;
+    return library;
+}
+
+std::shared_ptr<const MeshData> MeshLibrary::loadMesh(const fs::path &obj_file_path)
+{
+    MeshData cached;
+    if (readMeshCache(obj_file_path, cached))
+    {
+        return std::make_shared<const MeshData>(std::move(cached));
+    }
+
+    WavefrontObjFileParser obj_parser(obj_file_path);
+    if (obj_parser.parse())
+    {
+        // files with errors are not cached, so that the errors are reported
+        // every time they are loaded
+        writeMeshCache(obj_file_path, obj_parser.mesh());
+    }
+    else
+    {
+        obj_parser.printErrors();
+    }
+    return obj_parser.object().sharedMesh();
+}
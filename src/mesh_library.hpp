@@ -0,0 +1,40 @@
+#pragma once
+#include "mesh_data.hpp"
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// loads meshes from .obj files and shares each of them between all objects
+// placed from the same file, instead of loading it again for every object;
+// a mesh is kept as long as some object refers to it
+class MeshLibrary
+{
+public:
+
+    MeshLibrary() = default;
+
+    MeshLibrary(const MeshLibrary&) = delete;
+    MeshLibrary& operator=(const MeshLibrary&) = delete;
+
+    // the mesh of the .obj file, loaded by loadMesh() unless it is already
+    // in use; later changes of the file are not seen while it is in use
+    // may throw std::runtime_error if the file does not exist
+    std::shared_ptr<const MeshData> get(const std::filesystem::path& obj_file_path);
+
+    // library used by Object(path)
+    static MeshLibrary& global();
+
+    // loads the mesh from the .obj file's mesh cache (see mesh_cache.hpp) if
+    // the file has not changed since it was cached, else parses the file and
+    // writes the cache; parse errors are printed to std::clog
+    // may throw std::runtime_error if the file does not exist
+    static std::shared_ptr<const MeshData> loadMesh(
+        const std::filesystem::path& obj_file_path);
+
+private:
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::weak_ptr<const MeshData>> meshes_;
+};
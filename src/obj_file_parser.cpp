@@ -1,29 +1,127 @@
 #include "obj_file_parser.hpp"
 #include "object.hpp"
-#include "polygon.hpp"
-#include <armadillo>
+#include "mapped_file.hpp"
+#include "mesh_data.hpp"
+#include "task_pool.hpp"
+#include <SFML/Graphics/Color.hpp>
+#include <algorithm>
+#include <charconv>
 #include <filesystem>
 #include <fstream>
 #include <vector>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <stdexcept>
+#include <system_error>
 #include <iostream>
 #include <ios>
-#include <regex>
-#include <optional>
 
 namespace fs = std::filesystem;
 
-WavefrontObjFileParser::WavefrontObjFileParser(const fs::path &file_path)
+namespace
 {
-    if (fs::exists(file_path) && fs::is_regular_file(file_path)) 
+    bool isBlank(char c)
+    {
+        return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+    }
+
+    bool isDigit(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    // removes the first whitespace separated token from `text` and returns
+    // it, or an empty view if there are no more tokens
+    std::string_view nextToken(std::string_view& text)
+    {
+        std::size_t begin = 0;
+        while (begin < text.size() && isBlank(text[begin]))
+        {
+            ++begin;
+        }
+
+        std::size_t end = begin;
+        while (end < text.size() && !isBlank(text[end]))
+        {
+            ++end;
+        }
+
+        auto token = text.substr(begin, end - begin);
+        text.remove_prefix(end);
+        return token;
+    }
+
+    // parses a decimal number with an optional sign and exponent; the error
+    // is std::errc::invalid_argument unless the whole token is such a number
+    std::errc parseNumber(std::string_view token, double& value)
+    {
+        // from_chars does not accept a leading plus sign, but does accept
+        // "inf" and "nan", which are not numbers in .obj files
+        if (!token.empty() && token[0] == '+')
+        {
+            token.remove_prefix(1);
+        }
+
+        auto digits = token;
+        if (!digits.empty() && digits[0] == '-')
+        {
+            digits.remove_prefix(1);
+        }
+        if (digits.empty() || !(isDigit(digits[0]) || digits[0] == '.'))
+        {
+            return std::errc::invalid_argument;
+        }
+
+        auto [end, error] = std::from_chars(token.data(),
+                                            token.data() + token.size(),
+                                            value);
+        if (error == std::errc() && end != token.data() + token.size())
+        {
+            return std::errc::invalid_argument;
+        }
+        return error;
+    }
+
+    // digits of the vertex index of a face vertex written as `v`, `v/vt`,
+    // `v/vt/vn` or `v//vn` (with `/` or `\` separators), or an empty view
+    // if the token is not of that form
+    std::string_view vertexIndexDigits(std::string_view token)
+    {
+        auto first_separator = std::string_view::npos;
+        auto n_separators = 0;
+
+        for (std::size_t i = 0; i < token.size(); ++i)
+        {
+            if (token[i] == '/' || token[i] == '\\')
+            {
+                if (++n_separators > 2)
+                {
+                    return {};
+                }
+                first_separator = std::min(first_separator, i);
+            }
+            else if (!isDigit(token[i]))
+            {
+                return {};
+            }
+        }
+
+        return token.substr(0, first_separator);
+    }
+}
+
+WavefrontObjFileParser::WavefrontObjFileParser(const fs::path &file_path) :
+    filePath_(file_path)
+{
+    if (fs::exists(file_path) && fs::is_regular_file(file_path))
     {
         inStream_.exceptions(std::ios::badbit);
-        inStream_.open(file_path);
-    } 
-    else 
+        inStream_.open(file_path, std::ios::binary);
+    }
+    else
     {
-        std::string msg = "File `" + file_path.string() + 
+        std::string msg = "File `" + file_path.string() +
             "` does not exist";
         throw std::runtime_error(msg);
     }
@@ -31,19 +129,16 @@ WavefrontObjFileParser::WavefrontObjFileParser(const fs::path &file_path)
 
 bool WavefrontObjFileParser::parse()
 {
-    bool error_state = false;
-    
-    for (int line_number = 1; inStream_; ++line_number)
-    {
-        std::string line;
-        (void) std::getline(inStream_, line);
-        if (!line.empty())
-        {
-            error_state |= parseLine(line, line_number);
-        }
-    }
+    return parse(ParseOptions());
+}
 
-    return error_state;
+bool WavefrontObjFileParser::parse(const ParseOptions& options)
+{
+    bool success = options.parallel ? parseParallel(options) 
+                                    : parseSerial(options);
+    object_ = Object(std::move(mesh_));
+    mesh_ = MeshData();
+    return success;
 }
 
 void WavefrontObjFileParser::printErrors(std::ostream &output_stream) const
@@ -53,106 +148,322 @@ void WavefrontObjFileParser::printErrors(std::ostream &output_stream) const
 
 const Object &WavefrontObjFileParser::object() const
 {
-    for (int i = 0; i < object_.nPolygons(); ++i)
+    return object_;
+}
+
+const MeshData &WavefrontObjFileParser::mesh() const
+{
+    return object_.mesh();
+}
+
+bool WavefrontObjFileParser::parseSerial(const ParseOptions& options)
+{
+    // no need for a buffer larger than the whole file
+    auto chunk_size = std::clamp<std::size_t>(options.chunkSize, 1,
+                                              fs::file_size(filePath_) + 1);
+    std::vector<char> buffer;
+    std::size_t line_number = 1;
+
+    // bytes at the start of the buffer belonging to a line that continues in
+    // the next chunk
+    std::size_t carried = 0;
+
+    while (inStream_)
     {
-        std::cout << "Face " << i << ":" << std::endl;
-        const auto& f = object_.getPolygon(i);
-        for (int j = 0; j < f.nVertices(); ++j)
+        buffer.resize(carried + chunk_size);
+        inStream_.read(buffer.data() + carried, chunk_size);
+        const char* begin = buffer.data();
+        const char* data_end = begin + carried + inStream_.gcount();
+
+        // the last line is only complete once the whole file has been read
+        const char* end = data_end;
+        if (inStream_)
         {
-            const auto& v = f.getVertex(j);
-            std::cout << '\t' << "(";
-            std::cout << v[0] << ", ";
-            std::cout << v[1] << ", ";
-            std::cout << v[2] << ")";
-            std::cout << std::endl;
+            auto last_line_end = std::find(std::make_reverse_iterator(end),
+                                           std::make_reverse_iterator(begin),
+                                           '\n');
+            end = last_line_end.base();
         }
+
+        Chunk chunk;
+        parseChunk(begin, end, chunk);
+        auto& vertices = mesh_.vertices;
+        auto vertex_offset = vertices.size();
+        vertices.insert(vertices.end(), chunk.vertices.begin(),
+                        chunk.vertices.end());
+        resolveFaces(chunk, vertex_offset);
+        merge(chunk, line_number);
+        line_number += chunk.nLines;
+
+        carried = data_end - end;
+        std::copy(end, data_end, buffer.data());
     }
-    
-    return object_;
+
+    return !errorState_;
 }
 
-void WavefrontObjFileParser::reportError(std::size_t line_number, const std::string& reason)
+bool WavefrontObjFileParser::parseParallel(const ParseOptions& options)
 {
-    errorsStream_ << "Errot at " << filePath_.string() << ':' << line_number << ' ';
-    errorsStream_ << reason << std::endl;
+    auto chunk_size = std::max<std::size_t>(options.chunkSize, 1);
+
+    MappedFile file(filePath_);
+
+    // chunks end after the first line break following `chunk_size` bytes
+    std::vector<std::pair<const char*, const char*>> ranges;
+    const char* data_end = file.data() + file.size();
+    for (const char* begin = file.data(); begin != data_end;)
+    {
+        auto end = begin + std::min<std::size_t>(chunk_size, data_end - begin);
+        end = std::find(end, data_end, '\n');
+        end = end == data_end ? end : end + 1;
+        ranges.emplace_back(begin, end);
+        begin = end;
+    }
+
+    std::vector<Chunk> chunks(ranges.size());
+    TaskPool::TaskGroup group(TaskPool::global());
+
+    for (std::size_t i = 0; i < chunks.size(); ++i)
+    {
+        group.run([&ranges, &chunks, i]
+        {
+            parseChunk(ranges[i].first, ranges[i].second, chunks[i]);
+        });
+    }
+    group.wait();
+
+    // the vertices of every chunk follow those of the previous chunks
+    auto& vertices = mesh_.vertices;
+    std::vector<std::size_t> vertex_offsets;
+    for (const auto& chunk : chunks)
+    {
+        vertex_offsets.push_back(vertices.size());
+        vertices.insert(vertices.end(), chunk.vertices.begin(),
+                        chunk.vertices.end());
+    }
+
+    for (std::size_t i = 0; i < chunks.size(); ++i)
+    {
+        group.run([&chunks, &vertex_offsets, i]
+        {
+            resolveFaces(chunks[i], vertex_offsets[i]);
+        });
+    }
+    group.wait();
+
+    std::size_t line_number = 1;
+    for (auto& chunk : chunks)
+    {
+        merge(chunk, line_number);
+        line_number += chunk.nLines;
+    }
+
+    return !errorState_;
 }
 
-bool WavefrontObjFileParser::parseLine(const std::string &line, std::size_t line_number)
+void WavefrontObjFileParser::parseChunk(const char* begin, const char* end,
+                                        Chunk& chunk)
 {
-    static const std::regex FACE_DECL_REG(R"(^f(\s+(\d+)([\\\/]\d*){0,2}){3,}\s*$)");
-    static const std::regex FACE_VERTEX_INDICES_REG(R"((\d+)(?:[\/\\](\d*))?(?:[\/\\](\d*))?)");
-    static const std::regex VERTEX_DECL_REG(R"(^v\s+([+-]?([0-9]*[.])?[0-9]+)\s([+-]?([0-9]*[.])?[0-9]+)\s([+-]?([0-9]*[.])?[0-9]+)(\s([+-]?([0-9]*[.])?[0-9]+))?\s*$)");
-    
-    if (std::smatch r; std::regex_match(line, r, VERTEX_DECL_REG))
+    while (begin != end)
+    {
+        auto line_end = std::find(begin, end, '\n');
+        std::string_view line(begin, line_end - begin);
+        if (!line.empty())
+        {
+            parseLine(line, chunk);
+        }
+
+        ++chunk.nLines;
+        begin = line_end == end ? end : line_end + 1;
+    }
+}
+
+void WavefrontObjFileParser::parseLine(std::string_view line, Chunk& chunk)
+{
+    auto keyword = nextToken(line);
+    if (keyword == "v")
+    {
+        parseVertex(line, chunk);
+    }
+    else if (keyword == "f")
     {
-        double x, y, z;
-        std::optional<double> w;
+        parseFace(line, chunk);
+    }
+}
 
-        try
+void WavefrontObjFileParser::parseVertex(std::string_view arguments,
+                                         Chunk& chunk)
+{
+    // x, y, z and an optional w; lines of any other form are ignored
+    double coordinates[4];
+    auto n_coordinates = 0;
+    bool out_of_range = false;
+
+    for (auto token = nextToken(arguments); !token.empty();
+         token = nextToken(arguments))
+    {
+        if (n_coordinates == 4)
         {
-            x = std::stod(r.str(1));
-            y = std::stod(r.str(3));
-            z = std::stod(r.str(5));
+            return;
+        }
 
-            if (!r.str(8).empty())
-                w = std::stod(r.str(8));
+        auto error = parseNumber(token, coordinates[n_coordinates++]);
+        if (error == std::errc::result_out_of_range)
+        {
+            out_of_range = true;
         }
-        catch (std::out_of_range&)
+        else if (error != std::errc())
         {
-            reportError(line_number, "Vertex coordinates out of range");
-            return false;
+            return;
         }
+    }
 
-        arma::vec3 vertex;
+    if (n_coordinates < 3)
+    {
+        return;
+    }
 
-        if (w.has_value())
+    if (out_of_range)
+    {
+        chunk.errors.push_back({chunk.nLines, "Vertex coordinates out of range"});
+        return;
+    }
+
+    double x = coordinates[0], y = coordinates[1], z = coordinates[2];
+    if (n_coordinates == 4)
+    {
+        double w = coordinates[3];
+        if (w == 0)
         {
-            if (w.value() == 0)
-            {
-                reportError(line_number, "W coordinate cannot be zero");
-                return false;
-            }
-            
-            vertex = {x / w.value(), y / w.value(), z / w.value()};
+            chunk.errors.push_back({chunk.nLines, "W coordinate cannot be zero"});
+            return;
         }
-        else
+
+        chunk.vertices.push_back({x / w, y / w, z / w});
+    }
+    else
+    {
+        chunk.vertices.push_back({x, y, z});
+    }
+}
+
+void WavefrontObjFileParser::parseFace(std::string_view arguments,
+                                       Chunk& chunk)
+{
+    // the whole line is checked first, lines with fewer than three vertices
+    // or malformed vertices are ignored
+    auto n_vertices = 0u;
+    for (auto rest = arguments, token = nextToken(rest); !token.empty();
+         token = nextToken(rest))
+    {
+        if (vertexIndexDigits(token).empty())
         {
-            vertex = {x, y, z};
+            return;
         }
+        ++n_vertices;
+    }
 
-        vertexList_.emplace_back(vertex);
+    if (n_vertices < 3)
+    {
+        return;
     }
-    else if (std::regex_match(line, FACE_DECL_REG))
+
+    // whether the indices refer to existing vertices is only known once the
+    // vertices of the previous chunks are counted, see resolveFaces()
+    Face face;
+    face.line = chunk.nLines;
+    face.firstIndex = chunk.faceIndices.size();
+    face.nPrecedingVertices = chunk.vertices.size();
+
+    for (auto token = nextToken(arguments); !token.empty();
+         token = nextToken(arguments))
     {
-        Polygon face;
-        
-        auto beg = std::sregex_iterator(line.cbegin(), line.cend(), FACE_VERTEX_INDICES_REG);
-        auto end = std::sregex_iterator();
-        for (auto it = beg; it != end; ++it)
+        auto digits = vertexIndexDigits(token);
+        std::size_t v_index = 0;
+        auto [end, error] = std::from_chars(digits.data(),
+                                            digits.data() + digits.size(),
+                                            v_index);
+        if (error == std::errc::result_out_of_range)
         {
-            std::size_t v_index;
-            
-            try
-            {
-                v_index = std::stoull(it->str(1));
-            }
-            catch (std::out_of_range&)
-            {
-                reportError(line_number, "Vertex index `" + it->str(1) + "` is too large");
-                return false;
-            }
+            face.tooLargeIndexError = chunk.errors.size();
+            chunk.errors.push_back({chunk.nLines, "Vertex index `" + std::string(digits) + "` is too large"});
+            break;
+        }
+
+        chunk.faceIndices.push_back(v_index);
+    }
+
+    face.nIndices = chunk.faceIndices.size() - face.firstIndex;
+    chunk.faces.push_back(face);
+}
+
+void WavefrontObjFileParser::resolveFaces(Chunk& chunk,
+                                          std::size_t vertex_offset)
+{
+    chunk.resolvedFaces.reserve(chunk.faces.size());
+
+    for (std::size_t f = 0; f < chunk.faces.size(); ++f)
+    {
+        const auto& face = chunk.faces[f];
+        bool valid = face.tooLargeIndexError == Face::NO_INDEX;
+        auto n_existing = vertex_offset + face.nPrecedingVertices;
 
-            if (!(0 < v_index && v_index <= vertexList_.size()))
+        for (auto i = 0u; i < face.nIndices; ++i)
+        {
+            auto v_index = chunk.faceIndices[face.firstIndex + i];
+            if (!(0 < v_index && v_index <= n_existing))
             {
-                reportError(line_number, "Vertex with index `" + std::to_string(v_index) + "` does not exist");
-                return false;
+                // reported instead of a too large index later on the line
+                std::string reason = "Vertex with index `" + std::to_string(v_index) + "` does not exist";
+                if (valid)
+                {
+                    chunk.errors.push_back({face.line, reason});
+                }
+                else
+                {
+                    chunk.errors[face.tooLargeIndexError].reason = reason;
+                }
+                valid = false;
+                break;
             }
+        }
 
-            face.addVertex(vertexList_[v_index - 1]);
+        if (valid)
+        {
+            chunk.resolvedFaces.push_back(f);
         }
+    }
+}
 
-        object_.addPolygon(face);
+void WavefrontObjFileParser::merge(Chunk& chunk, std::size_t first_line_number)
+{
+    // there is at most one error per line
+    std::sort(chunk.errors.begin(), chunk.errors.end(),
+              [](const LineError& a, const LineError& b)
+              {
+                  return a.line < b.line;
+              });
+    for (const auto& error : chunk.errors)
+    {
+        reportError(first_line_number + error.line, error.reason);
     }
 
-    return true;
+    for (auto f : chunk.resolvedFaces)
+    {
+        const auto& face = chunk.faces[f];
+        for (auto k = 0u; k < face.nIndices; ++k)
+        {
+            auto v_index = chunk.faceIndices[face.firstIndex + k];
+            mesh_.faceIndices.push_back(v_index - 1);
+        }
+        mesh_.faceOffsets.push_back(mesh_.faceIndices.size());
+        mesh_.faceColors.push_back(sf::Color::White.toInteger());
+    }
+}
+
+void WavefrontObjFileParser::reportError(std::size_t line_number, const std::string& reason)
+{
+    errorState_ = true;
+    errorsStream_ << "Error at " << filePath_.string() << ':' << line_number << ' ';
+    errorsStream_ << reason << std::endl;
 }
@@ -1,12 +1,15 @@
 #pragma once
+#include "mesh_data.hpp"
 #include "object.hpp"
-#include <armadillo>
+#include <array>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <cstddef>
 #include <vector>
 #include <sstream>
 #include <string>
+#include <string_view>
 
 // reads vertices and faces data from a Wavefront .obj file
 // all other elements apart from vertices and faces are ignored
@@ -14,22 +17,99 @@ class WavefrontObjFileParser
 {
 public:
 
+    struct ParseOptions
+    {
+        // parse the chunks of the file as tasks of TaskPool::global(); the
+        // resulting object and errors are the same as when parsing on a
+        // single thread
+        bool parallel = true;
+
+        // the file is split at line breaks into chunks of about this many
+        // bytes; the serial parser reads one chunk at a time
+        std::size_t chunkSize = 1 << 20;
+    };
+
     // opens the .obj file
     // may throw std::runtime_error if the file does not exist
     WavefrontObjFileParser(const std::filesystem::path& file_path);
 
+    // returns false if some lines could not be parsed, see printErrors()
     bool parse();
+    bool parse(const ParseOptions& options);
     void printErrors(std::ostream& output_stream = std::clog) const;
     const Object& object() const;
 
+    // the vertices and faces read, as an indexed mesh
+    const MeshData& mesh() const;
+
 private:
 
+    using Vertex = std::array<double, 3>;
+
+    // a face declaration, with indices into Chunk::faceIndices
+    struct Face
+    {
+        std::size_t line;
+        std::size_t firstIndex;
+        std::size_t nIndices;
+
+        // vertices declared in the chunk before the face; faces can only
+        // refer to vertices declared before them
+        std::size_t nPrecedingVertices;
+
+        static constexpr std::size_t NO_INDEX = -1;
+
+        // index into Chunk::errors of the error for a vertex index too large
+        // to be represented, which ends the face's list of indices
+        std::size_t tooLargeIndexError = NO_INDEX;
+    };
+
+    struct LineError
+    {
+        std::size_t line;
+        std::string reason;
+    };
+
+    // records of a run of consecutive lines, parsed without knowing the lines
+    // and vertices before them; line numbers count from zero at the start of
+    // the chunk
+    struct Chunk
+    {
+        std::size_t              nLines = 0;
+        std::vector<Vertex>      vertices;
+        std::vector<Face>        faces;
+        std::vector<std::size_t> faceIndices;
+        std::vector<LineError>   errors;
+
+        // indices into `faces` of the faces whose vertices all exist, found
+        // by resolveFaces()
+        std::vector<std::size_t> resolvedFaces;
+    };
+
+    bool parseSerial(const ParseOptions& options);
+    bool parseParallel(const ParseOptions& options);
+
+    // parses the lines in [begin, end); the last line does not need to end
+    // with a line break
+    static void parseChunk(const char* begin, const char* end, Chunk& chunk);
+    static void parseLine(std::string_view line, Chunk& chunk);
+    static void parseVertex(std::string_view arguments, Chunk& chunk);
+    static void parseFace(std::string_view arguments, Chunk& chunk);
+
+    // checks that the faces of the chunk refer to existing vertices, given
+    // that `vertex_offset` vertices are declared before the chunk
+    static void resolveFaces(Chunk& chunk, std::size_t vertex_offset);
+
+    // adds the faces of a resolved chunk starting at line `first_line_number`
+    // to the mesh and reports its errors
+    void merge(Chunk& chunk, std::size_t first_line_number);
+
     void reportError(std::size_t line_number, const std::string& reason);
-    bool parseLine(const std::string& line, std::size_t line_number);
 
     std::filesystem::path   filePath_;
     std::ifstream           inStream_;
-    std::vector<arma::vec3> vertexList_;
+    MeshData                mesh_; // built while parsing, then moved to object_
     Object                  object_;
     std::ostringstream      errorsStream_;
+    bool                    errorState_ = false;
 };
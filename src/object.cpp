@@ -1,63 +1,267 @@
 #include "object.hpp"
-#include "obj_file_parser.hpp"
+#include "mesh_data.hpp"
+#include "mesh_library.hpp"
 #include "polygon.hpp"
+#include "transform.hpp"
 #include <SFML/Graphics/Color.hpp>
 #include <armadillo>
+#include <algorithm>
 #include <filesystem>
 #include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
 #include <vector>
 
-Object::Object(const std::filesystem::path &obj_file_path)
+Object::Object(const std::filesystem::path &obj_file_path) :
+    Object(MeshLibrary::global().get(obj_file_path))
+{}
+
+Object::Object(MeshData mesh) :
+    mesh_(std::make_shared<MeshData>(std::move(mesh))),
+    ownsMesh_(true)
+{}
+
+Object::Object(std::shared_ptr<const MeshData> mesh) :
+    mesh_(mesh ? std::move(mesh) : emptyMesh())
+{}
+
+std::size_t Object::nPolygons() const
 {
-    WavefrontObjFileParser obj_parser(obj_file_path);
-    if (!obj_parser.parse())
-    {
-        obj_parser.printErrors();
-    }
-    *this = obj_parser.object();
+    return mesh_->faceColors.size();
 }
 
-std::size_t Object::nPolygons() const
+std::size_t Object::nVertices() const
+{
+    return mesh_->vertices.size();
+}
+
+const Transform &Object::getTransform() const
+{
+    return transform_;
+}
+
+void Object::setTransform(const Transform &transform)
 {
-    return polygons_.size();
+    transform_ = transform;
 }
 
 arma::vec3 Object::getOrigin() const
 {
-    return origin_;
+    return transform_.getTranslation();
 }
 
 void Object::setOrigin(const arma::vec3 &pos)
 {
-    for (auto& poly : polygons_)
+    transform_.setTranslation(pos);
+}
+
+void Object::setColor(const sf::Color &color)
+{
+    faceColors_.assign(nPolygons(), color.toInteger());
+}
+
+Polygon Object::getPolygon(std::size_t index) const
+{
+    auto color = getPolygonColor(index);
+
+    Polygon polygon;
+    for (auto k = mesh_->faceOffsets[index]; k < mesh_->faceOffsets[index + 1]; ++k)
+    {
+        auto v = transform_.apply(mesh_->vertices[mesh_->faceIndices[k]]);
+        polygon.addVertex({v[0], v[1], v[2]});
+    }
+    polygon.setColor(color);
+    return polygon;
+}
+
+sf::Color Object::getPolygonColor(std::size_t index) const
+{
+    const auto& colors = faceColors_.empty() ? mesh_->faceColors : faceColors_;
+    return sf::Color(colors.at(index));
+}
+
+void Object::appendPolygons(std::vector<Polygon>& polygons) const
+{
+    std::vector<Transform::Point> vertices;
+    vertices.reserve(mesh_->vertices.size());
+    for (const auto& v : mesh_->vertices)
     {
-        for (auto i = 0u; i < poly.nVertices(); ++i)
+        vertices.push_back(transform_.apply(v));
+    }
+
+    polygons.reserve(polygons.size() + nPolygons());
+    for (std::size_t i = 0; i < nPolygons(); ++i)
+    {
+        auto& polygon = polygons.emplace_back();
+        for (auto k = mesh_->faceOffsets[i]; k < mesh_->faceOffsets[i + 1]; ++k)
         {
-            auto v = poly.getVertex(i);
-            poly.setVertex(i, v + origin_ - pos);
+            const auto& v = vertices[mesh_->faceIndices[k]];
+            polygon.addVertex({v[0], v[1], v[2]});
         }
+        polygon.setColor(getPolygonColor(i));
     }
 }
 
-void Object::setColor(const sf::Color &color)
+bool Object::setPolygon(std::size_t index, const Polygon &polygon)
+{
+    setPolygonColor(index, polygon.getColor());
+
+    auto begin = mesh_->faceOffsets[index];
+    auto end = mesh_->faceOffsets[index + 1];
+    auto n_vertices = polygon.nVertices();
+
+    // compared at the precision the polygon stores, so that a polygon got
+    // from getPolygon() leaves the face as it is
+    bool same_vertices = n_vertices == end - begin;
+    const Scalar* coordinates = polygon.coordinates();
+    for (auto k = 0u; same_vertices && k < n_vertices; ++k)
+    {
+        auto v = transform_.apply(mesh_->vertices[mesh_->faceIndices[begin + k]]);
+        same_vertices = Scalar(v[0]) == coordinates[3 * k]
+                        && Scalar(v[1]) == coordinates[3 * k + 1]
+                        && Scalar(v[2]) == coordinates[3 * k + 2];
+    }
+    if (same_vertices)
+    {
+        return false;
+    }
+
+    auto& mesh = editableMesh();
+    auto& face_indices = mesh.faceIndices;
+
+    // vertices of the face which no other face uses are overwritten rather
+    // than left behind, so that moving a polygon does not grow the mesh
+    std::vector<std::uint32_t> own_vertices(face_indices.begin() + begin,
+                                            face_indices.begin() + end);
+    for (std::size_t j = 0; j < face_indices.size(); ++j)
+    {
+        if (j >= begin && j < end)
+        {
+            continue;
+        }
+        own_vertices.erase(std::remove(own_vertices.begin(), own_vertices.end(),
+                                       face_indices[j]),
+                           own_vertices.end());
+    }
+
+    auto n_reused = std::min<std::size_t>(own_vertices.size(), n_vertices);
+    std::vector<std::uint32_t> indices(n_vertices);
+    for (std::size_t k = 0; k < n_reused; ++k)
+    {
+        auto v = transform_.applyInverse(polygon.getVertex(k));
+        mesh.vertices[own_vertices[k]] = {v[0], v[1], v[2]};
+        indices[k] = own_vertices[k];
+    }
+    if (n_reused < n_vertices)
+    {
+        std::iota(indices.begin() + n_reused, indices.end(),
+                  addVertices(mesh, polygon, n_reused));
+    }
+
+    face_indices.erase(face_indices.begin() + begin, face_indices.begin() + end);
+    face_indices.insert(face_indices.begin() + begin, indices.begin(),
+                        indices.end());
+    for (auto i = index + 1; i < mesh.faceOffsets.size(); ++i)
+    {
+        mesh.faceOffsets[i] = mesh.faceOffsets[i] - (end - begin) + n_vertices;
+    }
+
+    // own vertices left over when the polygon has fewer, each replaced by
+    // the last vertex of the mesh; from the highest index down, so that the
+    // last vertex is never one of those still to be removed
+    std::sort(own_vertices.begin() + n_reused, own_vertices.end(),
+              std::greater<>());
+    for (auto it = own_vertices.begin() + n_reused; it != own_vertices.end(); ++it)
+    {
+        auto last = std::uint32_t(mesh.vertices.size() - 1);
+        if (*it != last)
+        {
+            mesh.vertices[*it] = mesh.vertices[last];
+            std::replace(face_indices.begin(), face_indices.end(), last, *it);
+        }
+        mesh.vertices.pop_back();
+    }
+    return true;
+}
+
+void Object::setPolygonColor(std::size_t index, const sf::Color &color)
+{
+    if (index >= nPolygons())
+    {
+        throw std::out_of_range("Polygon index out of range");
+    }
+
+    if (faceColors_.empty())
+    {
+        faceColors_ = mesh_->faceColors;
+    }
+    faceColors_[index] = color.toInteger();
+}
+
+void Object::addPolygon(const Polygon& polygon)
 {
-    for (auto& p : polygons_)
+    auto& mesh = editableMesh();
+    auto first_vertex = addVertices(mesh, polygon, 0);
+    for (auto k = 0u; k < polygon.nVertices(); ++k)
     {
-        p.setColor(color);
+        mesh.faceIndices.push_back(first_vertex + k);
+    }
+    mesh.faceOffsets.push_back(mesh.faceIndices.size());
+    mesh.faceColors.push_back(polygon.getColor().toInteger());
+
+    if (!faceColors_.empty())
+    {
+        faceColors_.push_back(polygon.getColor().toInteger());
     }
 }
 
-const Polygon &Object::getPolygon(std::size_t index) const
+const MeshData &Object::mesh() const
 {
-    return polygons_.at(index);
+    return *mesh_;
 }
 
-void Object::setPolygon(std::size_t index, const Polygon &polygon)
+std::shared_ptr<const MeshData> Object::sharedMesh() const
 {
-    polygons_.at(index) = polygon;
+    return mesh_;
 }
 
-void Object::addPolygon(const Polygon& polygon)
+MeshData &Object::editableMesh()
+{
+    if (!ownsMesh_ || mesh_.use_count() > 1)
+    {
+        mesh_ = std::make_shared<MeshData>(*mesh_);
+        ownsMesh_ = true;
+    }
+
+    // made non-const by this object, and referred to by no other object
+    return const_cast<MeshData&>(*mesh_);
+}
+
+std::uint32_t Object::addVertices(MeshData &mesh, const Polygon &polygon,
+                                  unsigned int first)
+{
+    if (mesh.vertices.size() + polygon.nVertices() - first
+        > std::numeric_limits<std::uint32_t>::max())
+    {
+        throw std::length_error("Too many vertices in object");
+    }
+
+    auto first_vertex = static_cast<std::uint32_t>(mesh.vertices.size());
+    for (auto k = first; k < polygon.nVertices(); ++k)
+    {
+        auto v = transform_.applyInverse(polygon.getVertex(k));
+        mesh.vertices.push_back({v[0], v[1], v[2]});
+    }
+    return first_vertex;
+}
+
+const std::shared_ptr<const MeshData> &Object::emptyMesh()
 {
-    polygons_.emplace_back(polygon);
+    static const auto mesh = std::make_shared<const MeshData>();
+    return mesh;
 }
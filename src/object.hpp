@@ -1,12 +1,22 @@
 #pragma once
+#include "mesh_data.hpp"
 #include "polygon.hpp"
+#include "transform.hpp"
 #include <SFML/Graphics/Color.hpp>
 #include <armadillo>
 #include <filesystem>
+#include <memory>
 #include <vector>
 #include <cstddef>
+#include <cstdint>
 
 // class for 3D objects (set of polygons)
+//
+// An object is an instance of a mesh placed in the scene by a transform. The
+// mesh is immutable and can be shared by many objects, e.g. all objects
+// loaded from the same .obj file; each of them only stores its transform and,
+// if they are changed, the colors of its polygons. The polygons are made by
+// transforming the mesh when they are requested.
 class Object
 {
 public:
@@ -14,23 +24,80 @@ public:
     // creates empty object
     Object() = default;
 
-    // loads object from an .obj (Wavefront) file
+    // object with the mesh of an .obj (Wavefront) file, shared with the other
+    // objects loaded from the same file through MeshLibrary::global()
+    // may throw std::runtime_error if the file does not exist
     Object(const std::filesystem::path& obj_file_path);
+
+    // object with the faces of the mesh
+    explicit Object(MeshData mesh);
+    explicit Object(std::shared_ptr<const MeshData> mesh);
     
     std::size_t nPolygons() const;
 
+    // number of vertices of the mesh, each counted once however many faces
+    // use it
+    std::size_t nVertices() const;
+
+    const Transform& getTransform() const;
+    void             setTransform(const Transform& transform);
+
+    // the translation of the transform
     arma::vec3 getOrigin() const;
     void       setOrigin(const arma::vec3& pos);
 
     // sets color of every polygon of the object to `color`
     void setColor(const sf::Color& color);
 
-    const Polygon& getPolygon(std::size_t index) const;
-    void setPolygon(std::size_t index, const Polygon& polygon);
+    // polygon of the face with the given index, in scene coordinates; made
+    // on every call
+    Polygon getPolygon(std::size_t index) const;
+    sf::Color getPolygonColor(std::size_t index) const;
+
+    // appends the polygons of all faces in scene coordinates, transforming
+    // every vertex once
+    void appendPolygons(std::vector<Polygon>& polygons) const;
+
+    // replaces the face with the polygon, given in scene coordinates; if the
+    // polygon's vertices differ from the face's, the face gets new vertices
+    // of its own, which no other face shares; vertices only the face used
+    // are reused or removed, so the mesh does not grow with every change
+    // changing the vertices makes a copy of the mesh, unless no other object
+    // shares it; returns true if the vertices changed, false if only the
+    // color could have
+    bool setPolygon(std::size_t index, const Polygon& polygon);
+    void setPolygonColor(std::size_t index, const sf::Color& color);
+
+    // adds the polygon, given in scene coordinates, as a face with vertices
+    // of its own; also copies a shared mesh
     void addPolygon(const Polygon&);
 
+    // the mesh in the object's own coordinates, and the colors of its faces
+    // as set for the mesh, not for this object
+    const MeshData&                 mesh() const;
+    std::shared_ptr<const MeshData> sharedMesh() const;
+
 private:
 
-    arma::vec3 origin_;
-    std::vector<Polygon> polygons_;
+    // the mesh, copied first unless this object is the only one using it
+    MeshData& editableMesh();
+
+    // appends the polygon's vertices from vertex `first` on to the mesh,
+    // returns the index of the first one appended
+    std::uint32_t addVertices(MeshData& mesh, const Polygon& polygon,
+                              unsigned int first);
+
+    static const std::shared_ptr<const MeshData>& emptyMesh();
+
+    std::shared_ptr<const MeshData> mesh_ = emptyMesh();
+
+    // true if mesh_ was made by this object and may be changed when no other
+    // object refers to it
+    bool                            ownsMesh_ = false;
+
+    Transform                       transform_;
+
+    // colors of the faces of this object, if any of them differ from those
+    // of the mesh
+    std::vector<std::uint32_t>      faceColors_;
 };
@@ -0,0 +1,417 @@
+#include "object_bsp_trees.hpp"
+#include "bounding_box.hpp"
+#include "bsp_tree.hpp"
+#include "frustum.hpp"
+#include "mesh_data.hpp"
+#include "object.hpp"
+#include "polygon.hpp"
+#include "transform.hpp"
+#include <SFML/Graphics/Color.hpp>
+#include <armadillo>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+void ObjectBSPTrees::invalidate()
+{
+    for (auto& entry : entries_)
+    {
+        entry.outdated = true;
+    }
+    layoutOutdated_ = true;
+}
+
+void ObjectBSPTrees::invalidateObject(std::size_t index)
+{
+    // objects added since the last update are outdated already
+    if (index < entries_.size())
+    {
+        entries_[index].outdated = true;
+    }
+}
+
+void ObjectBSPTrees::recolorObject(std::size_t index)
+{
+    if (index < entries_.size())
+    {
+        entries_[index].recolored = true;
+    }
+}
+
+void ObjectBSPTrees::clear()
+{
+    meshTrees_.clear();
+    entries_.clear();
+    groups_.clear();
+    layout_.clear();
+    layoutOutdated_ = true;
+}
+
+void ObjectBSPTrees::update(const std::vector<Object>& objects)
+{
+    bool meshes_changed = false;
+    if (entries_.size() != objects.size())
+    {
+        entries_.resize(objects.size());
+        layoutOutdated_ = true;
+        meshes_changed = true;
+    }
+
+    for (std::size_t i = 0; i < objects.size(); ++i)
+    {
+        auto& entry = entries_[i];
+        if (!entry.outdated)
+        {
+            continue;
+        }
+
+        const auto& object = objects[i];
+        if (entry.mesh != &object.mesh())
+        {
+            entry.meshTree = meshTree(object.sharedMesh());
+            entry.mesh = &object.mesh();
+            meshes_changed = true;
+        }
+        entry.transform = object.getTransform();
+        transformFragments(object, entry);
+        entry.version = ++lastVersion_;
+        entry.outdated = false;
+        entry.recolored = false;
+        layoutOutdated_ = true;
+    }
+
+    // trees no object refers to any more
+    if (meshes_changed)
+    {
+        for (auto it = meshTrees_.begin(); it != meshTrees_.end();)
+        {
+            it = it->second.tree.use_count() == 1 ? meshTrees_.erase(it)
+                                                   : std::next(it);
+        }
+    }
+
+    if (layoutOutdated_)
+    {
+        buildLayout(objects);
+    }
+
+    for (std::size_t i = 0; i < objects.size(); ++i)
+    {
+        auto& entry = entries_[i];
+        if (!entry.recolored)
+        {
+            continue;
+        }
+
+        const auto& object = objects[i];
+        for (auto& fragment : entry.fragments)
+        {
+            fragment.setColor(object.getPolygonColor(fragment.getSourceIndex()));
+        }
+
+        if (entry.group != NO_INDEX)
+        {
+            auto& group = groups_[entry.group];
+            auto k = std::lower_bound(group.objects.begin(), group.objects.end(),
+                                      std::uint32_t(i))
+                     - group.objects.begin();
+            std::vector<sf::Color> colors(object.nPolygons());
+            for (std::size_t j = 0; j < colors.size(); ++j)
+            {
+                colors[j] = object.getPolygonColor(j);
+            }
+            group.tree.setSourceColors(group.firstSources[k], colors);
+        }
+        entry.recolored = false;
+    }
+}
+
+std::vector<const Polygon*> ObjectBSPTrees::depthSortedPolygons(
+    const arma::vec3 observer_position, const Frustum& view_frustum) const
+{
+    std::vector<const Polygon*> sorted_polygons;
+    if (layout_.empty())
+    {
+        return sorted_polygons;
+    }
+
+    std::vector<std::uint32_t> stack = {0};
+    while (!stack.empty())
+    {
+        const auto& node = layout_[stack.back()];
+        stack.pop_back();
+
+        if (!node.leaf)
+        {
+            // the side of the observer is drawn last, so it is pushed first
+            bool observer_above = observer_position[node.axis] >= node.position;
+            stack.push_back(observer_above ? node.above : node.below);
+            stack.push_back(observer_above ? node.below : node.above);
+            continue;
+        }
+
+        auto plane_mask = view_frustum.allPlanesMask();
+        if (view_frustum.cull(node.bounds, plane_mask))
+        {
+            continue;
+        }
+
+        if (node.group != NO_INDEX)
+        {
+            groups_[node.group].tree.appendDepthSortedPolygons(sorted_polygons,
+                                                               observer_position);
+            continue;
+        }
+
+        // the mesh's tree sorts its own fragments for the observer in mesh
+        // coordinates, which are then swapped for the transformed ones
+        const auto& entry = entries_[node.object];
+        auto begin = sorted_polygons.size();
+        entry.meshTree->appendDepthSortedPolygons(
+            sorted_polygons, entry.transform.applyInverse(observer_position));
+
+        const Polygon* mesh_fragments = entry.meshTree->fragments().data();
+        for (auto k = begin; k < sorted_polygons.size(); ++k)
+        {
+            sorted_polygons[k] = &entry.fragments[sorted_polygons[k]
+                                                  - mesh_fragments];
+        }
+    }
+
+    return sorted_polygons;
+}
+
+std::size_t ObjectBSPTrees::nMeshTrees() const
+{
+    return meshTrees_.size();
+}
+
+std::size_t ObjectBSPTrees::nMergedGroups() const
+{
+    return groups_.size();
+}
+
+std::size_t ObjectBSPTrees::nMergedObjects() const
+{
+    std::size_t n_objects = 0;
+    for (const auto& group : groups_)
+    {
+        n_objects += group.objects.size();
+    }
+    return n_objects;
+}
+
+std::shared_ptr<const BSPTree> ObjectBSPTrees::meshTree(
+    const std::shared_ptr<const MeshData>& mesh)
+{
+    auto& cached = meshTrees_[mesh.get()];
+    if (!cached.tree)
+    {
+        // the mesh's faces in its own coordinates, with the mesh's colors;
+        // the fragments of the objects take their own
+        std::vector<Polygon> mesh_polygons;
+        Object(mesh).appendPolygons(mesh_polygons);
+
+        cached.mesh = mesh;
+        cached.tree = std::make_shared<const BSPTree>(mesh_polygons);
+    }
+    return cached.tree;
+}
+
+void ObjectBSPTrees::transformFragments(const Object& object, ObjectEntry& entry)
+{
+    const auto& mesh_fragments = entry.meshTree->fragments();
+    const auto& transform = object.getTransform();
+
+    entry.fragments.resize(mesh_fragments.size());
+    entry.bounds = BoundingBox();
+
+    for (std::size_t i = 0; i < mesh_fragments.size(); ++i)
+    {
+        const auto& mesh_fragment = mesh_fragments[i];
+        const Scalar* coordinates = mesh_fragment.coordinates();
+
+        Polygon fragment;
+        for (auto k = 0u; k < mesh_fragment.nVertices(); ++k)
+        {
+            auto v = transform.apply(Transform::Point{coordinates[3 * k],
+                                                      coordinates[3 * k + 1],
+                                                      coordinates[3 * k + 2]});
+            arma::vec3 vertex = {v[0], v[1], v[2]};
+            fragment.addVertex(vertex);
+            entry.bounds.extend(vertex);
+        }
+
+        auto source = mesh_fragment.getSourceIndex();
+        fragment.setColor(object.getPolygonColor(source));
+        fragment.setSourceIndex(source);
+        entry.fragments[i] = std::move(fragment);
+    }
+}
+
+void ObjectBSPTrees::buildLayout(const std::vector<Object>& objects)
+{
+    auto previous_groups = std::move(groups_);
+    groups_.clear();
+    layout_.clear();
+    layoutOutdated_ = false;
+
+    std::vector<std::uint32_t> all_objects;
+    for (std::size_t i = 0; i < entries_.size(); ++i)
+    {
+        entries_[i].group = NO_INDEX;
+        if (!entries_[i].bounds.empty())
+        {
+            all_objects.push_back(std::uint32_t(i));
+        }
+    }
+    if (all_objects.empty())
+    {
+        return;
+    }
+
+    struct WorkItem
+    {
+        std::vector<std::uint32_t> objects;
+        std::uint32_t              node;
+    };
+
+    layout_.emplace_back();
+    std::vector<WorkItem> stack;
+    stack.push_back({std::move(all_objects), 0});
+
+    std::vector<std::uint32_t> sorted;
+    std::vector<std::uint32_t> best_sorted;
+
+    while (!stack.empty())
+    {
+        auto item = std::move(stack.back());
+        stack.pop_back();
+        auto n = item.objects.size();
+
+        // of the gaps between the boxes along each axis, the one splitting
+        // the objects most evenly
+        std::size_t best_split = 0;
+        std::size_t best_imbalance = std::numeric_limits<std::size_t>::max();
+        unsigned int best_axis = 0;
+        Scalar best_position = 0;
+
+        for (unsigned int axis = 0; axis < 3 && n > 1; ++axis)
+        {
+            sorted = item.objects;
+            std::sort(sorted.begin(), sorted.end(),
+                      [&](std::uint32_t a, std::uint32_t b)
+            {
+                return entries_[a].bounds.min[axis] < entries_[b].bounds.min[axis];
+            });
+
+            bool improved = false;
+            auto reach = -std::numeric_limits<Scalar>::infinity();
+            for (std::size_t i = 1; i < n; ++i)
+            {
+                reach = std::max(reach, entries_[sorted[i - 1]].bounds.max[axis]);
+                auto next = entries_[sorted[i]].bounds.min[axis];
+                auto imbalance = std::size_t(std::abs(std::ptrdiff_t(2 * i)
+                                                      - std::ptrdiff_t(n)));
+                if (reach <= next && imbalance < best_imbalance)
+                {
+                    best_split = i;
+                    best_imbalance = imbalance;
+                    best_axis = axis;
+                    best_position = (reach + next) / 2;
+                    improved = true;
+                }
+            }
+            if (improved)
+            {
+                best_sorted.swap(sorted);
+            }
+        }
+
+        if (best_split == 0)
+        {
+            auto& node = layout_[item.node];
+            node.leaf = true;
+            for (auto object : item.objects)
+            {
+                node.bounds.extend(entries_[object].bounds);
+            }
+
+            if (n == 1)
+            {
+                node.object = item.objects[0];
+            }
+            else
+            {
+                std::sort(item.objects.begin(), item.objects.end());
+                // layout_ is not resized by this, so `node` stays valid
+                node.group = mergedGroup(item.objects, objects, previous_groups);
+            }
+            continue;
+        }
+
+        auto below = std::uint32_t(layout_.size());
+        auto above = below + 1;
+        layout_.resize(layout_.size() + 2);
+
+        auto& node = layout_[item.node];
+        node.axis = best_axis;
+        node.position = best_position;
+        node.below = below;
+        node.above = above;
+
+        stack.push_back({std::vector<std::uint32_t>(best_sorted.begin(),
+                                                    best_sorted.begin() + best_split),
+                         below});
+        stack.push_back({std::vector<std::uint32_t>(best_sorted.begin() + best_split,
+                                                    best_sorted.end()),
+                         above});
+    }
+}
+
+std::uint32_t ObjectBSPTrees::mergedGroup(
+    const std::vector<std::uint32_t>& objects,
+    const std::vector<Object>& scene_objects,
+    std::vector<MergedGroup>& previous_groups)
+{
+    auto index = std::uint32_t(groups_.size());
+    for (auto object : objects)
+    {
+        entries_[object].group = index;
+    }
+
+    for (auto& group : previous_groups)
+    {
+        bool unchanged = group.objects == objects;
+        for (std::size_t k = 0; unchanged && k < objects.size(); ++k)
+        {
+            unchanged = group.versions[k] == entries_[objects[k]].version;
+        }
+        if (unchanged)
+        {
+            groups_.push_back(std::move(group));
+            group.objects.clear();
+            return index;
+        }
+    }
+
+    MergedGroup group;
+    group.objects = objects;
+    std::vector<Polygon> polygons;
+    for (auto object : objects)
+    {
+        group.versions.push_back(entries_[object].version);
+        group.firstSources.push_back(std::uint32_t(polygons.size()));
+        scene_objects[object].appendPolygons(polygons);
+    }
+    group.tree = BSPTree(polygons);
+
+    groups_.push_back(std::move(group));
+    return index;
+}
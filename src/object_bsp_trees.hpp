@@ -0,0 +1,146 @@
+#pragma once
+#include "bounding_box.hpp"
+#include "bsp_tree.hpp"
+#include "frustum.hpp"
+#include "mesh_data.hpp"
+#include "object.hpp"
+#include "polygon.hpp"
+#include "scalar.hpp"
+#include "transform.hpp"
+#include <armadillo>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// two-level depth ordering of the polygons of a set of objects, which lets
+// objects move without building any BSP tree again
+//
+// Every mesh gets a BSP tree of its own, built once in the mesh's own
+// coordinates and shared by the objects using it. A transform maps the
+// planes of that tree to planes with the same points on either side, so an
+// object is ordered by traversing the tree of its mesh for the observer
+// position taken into the mesh's coordinates. Moving an object only
+// transforms the fragments of its tree again.
+//
+// Objects are ordered against each other by a tree of axis-aligned planes
+// lying between their bounding boxes, rebuilt (cheaply, from the boxes alone)
+// when an object moves. Objects whose boxes no such plane separates, e.g.
+// because they intersect, are ordered together by a BSP tree built from all
+// of their polygons in scene coordinates, which is rebuilt when one of them
+// moves or the group changes.
+class ObjectBSPTrees
+{
+public:
+
+    // the objects changed as a whole, e.g. some were added or removed; the
+    // trees of meshes still in use are kept
+    void invalidate();
+
+    // the transform or the polygons of the object changed
+    void invalidateObject(std::size_t index);
+
+    // the polygon colors of the object changed
+    void recolorObject(std::size_t index);
+
+    // forgets everything, including the trees of the meshes
+    void clear();
+
+    // brings the ordering up to date with `objects`, the same objects, in
+    // the same order, as every call before unless invalidate() was called
+    void update(const std::vector<Object>& objects);
+
+    // polygons of the objects as of the last update(), sorted back to front
+    // for the observer; objects lying entirely outside of the view frustum
+    // are left out
+    std::vector<const Polygon*> depthSortedPolygons(
+        const arma::vec3 observer_position, const Frustum& view_frustum) const;
+
+    // meshes with a tree of their own
+    std::size_t nMeshTrees() const;
+
+    // groups of objects ordered by a merged tree, and the objects in them
+    std::size_t nMergedGroups() const;
+    std::size_t nMergedObjects() const;
+
+private:
+
+    static constexpr std::uint32_t NO_INDEX =
+        std::numeric_limits<std::uint32_t>::max();
+
+    // the tree of a mesh; holding the mesh keeps its address from being
+    // reused, and makes an edit of an object's polygons copy the mesh rather
+    // than change it in place
+    struct MeshTree
+    {
+        std::shared_ptr<const MeshData> mesh;
+        std::shared_ptr<const BSPTree>  tree;
+    };
+
+    struct ObjectEntry
+    {
+        const MeshData*                 mesh = nullptr;
+        std::shared_ptr<const BSPTree>  meshTree;
+        Transform                       transform;
+
+        // the fragments of meshTree in scene coordinates, in the same order
+        std::vector<Polygon>            fragments;
+        BoundingBox                     bounds;
+
+        // changes whenever the fragments do
+        std::uint64_t                   version = 0;
+        std::uint32_t                   group = NO_INDEX;
+        bool                            outdated = true;
+        bool                            recolored = false;
+    };
+
+    // objects ordered by one tree of their polygons in scene coordinates
+    struct MergedGroup
+    {
+        std::vector<std::uint32_t> objects;  // in increasing order
+        std::vector<std::uint64_t> versions; // of the objects, when built
+        std::vector<std::uint32_t> firstSources; // per object
+        BSPTree                    tree;
+    };
+
+    // node of the tree ordering the objects; an inner node separates the
+    // objects with boxes below and above x[axis] = position, a leaf holds
+    // one object or one merged group
+    struct LayoutNode
+    {
+        unsigned int  axis = 0;
+        Scalar        position = 0;
+        std::uint32_t below = NO_INDEX;
+        std::uint32_t above = NO_INDEX;
+
+        bool          leaf = false;
+        std::uint32_t object = NO_INDEX;
+        std::uint32_t group = NO_INDEX;
+        BoundingBox   bounds;
+    };
+
+    // the tree of the mesh, built unless another object uses it already
+    std::shared_ptr<const BSPTree> meshTree(
+        const std::shared_ptr<const MeshData>& mesh);
+
+    static void transformFragments(const Object& object, ObjectEntry& entry);
+
+    // splits the objects into a tree of separating planes, building merged
+    // trees for the groups left over
+    void buildLayout(const std::vector<Object>& objects);
+
+    // returns the group of the objects, reusing a previous one if none of
+    // them changed since it was built
+    std::uint32_t mergedGroup(const std::vector<std::uint32_t>& objects,
+                              const std::vector<Object>& scene_objects,
+                              std::vector<MergedGroup>& previous_groups);
+
+    std::unordered_map<const MeshData*, MeshTree> meshTrees_;
+    std::vector<ObjectEntry>                      entries_;
+    std::vector<MergedGroup>                      groups_;
+    std::vector<LayoutNode>                       layout_; // root first
+    bool                                          layoutOutdated_ = true;
+    std::uint64_t                                 lastVersion_ = 0;
+};
@@ -0,0 +1,24 @@
+#include "plane.hpp"
+#include <armadillo>
+
+Plane::Plane(const arma::vec3 &unit_normal, const arma::vec3 &point) :
+    nx(unit_normal[0]),
+    ny(unit_normal[1]),
+    nz(unit_normal[2]),
+    d(-arma::dot(unit_normal, point))
+{}
+
+arma::vec3 Plane::normal() const
+{
+    return {nx, ny, nz};
+}
+
+Plane Plane::flipped() const
+{
+    Plane p;
+    p.nx = -nx;
+    p.ny = -ny;
+    p.nz = -nz;
+    p.d = -d;
+    return p;
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include "scalar.hpp"
+#include <armadillo>
+
+// plane of points `x` satisfying dot(normal, x) + d = 0, with a unit length
+// normal; stored as four plain numbers so that it can be kept inline in
+// tightly packed structures
+struct Plane
+{
+    Scalar nx = 0, ny = 0, nz = 0;
+    Scalar d  = 0;
+
+    Plane() = default;
+    Plane(const arma::vec3& unit_normal, const arma::vec3& point);
+
+    arma::vec3 normal() const;
+
+    // positive in front of the plane (on the side the normal points to),
+    // negative behind it
+    Scalar signedDistance(const arma::vec3& point) const
+    {
+        return signedDistance(Scalar(point[0]), Scalar(point[1]),
+                              Scalar(point[2]));
+    }
+
+    Scalar signedDistance(Scalar x, Scalar y, Scalar z) const
+    {
+        return nx * x + ny * y + nz * z + d;
+    }
+
+    // the same plane with the front and back sides swapped
+    Plane flipped() const;
+};
@@ -1,6 +1,10 @@
 #include "polygon.hpp"
+#include "plane.hpp"
 #include <SFML/Graphics/Color.hpp>
 #include <armadillo>
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <stdexcept>
 #include <vector>
 #include <optional>
@@ -29,12 +33,19 @@ bool Polygon::empty() const
 
 void Polygon::setVertex(unsigned int index, const arma::vec3 &position)
 {
-    vertices_.at(index) = position;
+    vertices_.at(index) = toCoordinates(position);
 }
 
 arma::vec3 Polygon::getVertex(unsigned int index) const
 {
-    return vertices_.at(index);
+    return toVec(vertices_.at(index));
+}
+
+const Scalar* Polygon::coordinates() const
+{
+    static_assert(sizeof(Coordinates) == 3 * sizeof(Scalar),
+                  "vertex coordinates must be tightly packed");
+    return vertices_.data()->data();
 }
 
 Polygon::Edge Polygon::getEdge(unsigned int index) const
@@ -55,7 +66,7 @@ Polygon::Edge Polygon::getEdge(unsigned int index) const
 
 void Polygon::addVertex(const arma::vec3 &position)
 {
-    vertices_.emplace_back(position);
+    vertices_.push_back(toCoordinates(position));
 }
 
 sf::Color Polygon::getColor() const
@@ -68,36 +79,109 @@ void Polygon::setColor(const sf::Color &color)
     color_ = color;
 }
 
+std::uint32_t Polygon::getSourceIndex() const
+{
+    return sourceIndex_;
+}
+
+void Polygon::setSourceIndex(std::uint32_t index)
+{
+    sourceIndex_ = index;
+}
+
 Polygon Polygon::clip(const Polygon& polygon, const arma::vec3 &plane_normal, 
                       const arma::vec3 &plane_point)
+{
+    return clip(polygon, Plane(plane_normal, plane_point));
+}
+
+Polygon Polygon::clip(const Polygon& polygon, const Plane& plane)
 {
     Polygon clipped_polygon = {};
     clipped_polygon.setColor(polygon.getColor());
+    clipped_polygon.setSourceIndex(polygon.getSourceIndex());
+
+    auto n = polygon.nVertices();
+    if (n == 0)
+    {
+        return clipped_polygon;
+    }
+
+    // the signed distances are computed once per vertex and reused as the
+    // edge end of one edge and the start of the next one
+    auto distance = [&plane](const Coordinates& c)
+    {
+        return plane.signedDistance(c[0], c[1], c[2]);
+    };
+
+    const auto* start = &polygon.vertices_[0];
+    Scalar start_distance = distance(*start);
 
-    for (auto i = 0u; i < polygon.nEdges(); ++i)
+    for (auto i = 0u; i < n; ++i)
     {
-        auto e = polygon.getEdge(i);
-        double edge_start_dot = arma::dot(plane_normal, e.first - plane_point);
-        double edge_end_dot = arma::dot(plane_normal, e.second - plane_point);
-        bool is_start_inside = edge_start_dot > 1e-6;
-        bool is_end_inside = edge_end_dot > 1e-6;
+        const auto* end = &polygon.vertices_[(i + 1) % n];
+        Scalar end_distance = distance(*end);
+        bool is_start_inside = start_distance > CLIP_TOLERANCE;
+        bool is_end_inside = end_distance > CLIP_TOLERANCE;
 
         if (is_start_inside)
         {
-            clipped_polygon.addVertex(e.first);
+            clipped_polygon.vertices_.push_back(*start);
         }
 
         if (is_start_inside != is_end_inside)
         {
-            auto intersection_point = linePlaneIntersection(
-                    e.first, e.second, plane_normal, plane_point);
-            clipped_polygon.addVertex(intersection_point);            
+            Scalar t = start_distance / (start_distance - end_distance);
+            clipped_polygon.vertices_.push_back({
+                (*start)[0] + t * ((*end)[0] - (*start)[0]),
+                (*start)[1] + t * ((*end)[1] - (*start)[1]),
+                (*start)[2] + t * ((*end)[2] - (*start)[2])
+            });
         }
+
+        start = end;
+        start_distance = end_distance;
     }
 
     return clipped_polygon;
 }
 
+Polygon::Side Polygon::classify(const arma::vec3 &plane_normal,
+                               const arma::vec3 &plane_point) const
+{
+    return classify(Plane(plane_normal, plane_point));
+}
+
+Polygon::Side Polygon::classify(const Plane& plane) const
+{
+    bool has_front = false;
+    bool has_back = false;
+
+    for (const auto& v : vertices_)
+    {
+        Scalar d = plane.signedDistance(v[0], v[1], v[2]);
+        has_front |= d > CLIP_TOLERANCE;
+        has_back |= d < -CLIP_TOLERANCE;
+    }
+
+    if (has_front && has_back)
+    {
+        return Side::Spanning;
+    }
+    else if (has_front)
+    {
+        return Side::Front;
+    }
+    else if (has_back)
+    {
+        return Side::Back;
+    }
+    else
+    {
+        return Side::Coplanar;
+    }
+}
+
 bool Polygon::isCoplanar(const Polygon& other) const
 {
     arma::vec3 v = getVertex(1) - getVertex(0);
@@ -119,8 +203,45 @@ bool Polygon::isCoplanar(const Polygon& other) const
 
 arma::vec3 Polygon::normal() const
 {
-    return arma::normalise(arma::cross(getVertex(0) - getVertex(1), 
-                                       getVertex(0) - getVertex(2)));
+    auto n = newellNormal();
+    return arma::normalise(arma::vec3{n[0], n[1], n[2]});
+}
+
+bool Polygon::facesPoint(const arma::vec3 &point) const
+{
+    if (vertices_.size() < 3)
+    {
+        return true;
+    }
+
+    // no need to normalise, only the sign matters
+    auto n = newellNormal();
+    const auto& v0 = vertices_[0];
+    return n[0] * (point[0] - v0[0]) + n[1] * (point[1] - v0[1])
+           + n[2] * (point[2] - v0[2]) > 0;
+}
+
+std::array<double, 3> Polygon::newellNormal() const
+{
+    // Newell's method; unlike the cross product of the first two edges it
+    // also works when some of the first vertices coincide or are collinear,
+    // as they can after clipping
+    double x = 0, y = 0, z = 0;
+    auto n = vertices_.size();
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        const auto& a = vertices_[i];
+        const auto& b = vertices_[(i + 1) % n];
+        x += (double(a[1]) - b[1]) * (double(a[2]) + b[2]);
+        y += (double(a[2]) - b[2]) * (double(a[0]) + b[0]);
+        z += (double(a[0]) - b[0]) * (double(a[1]) + b[1]);
+    }
+    return {x, y, z};
+}
+
+Plane Polygon::plane() const
+{
+    return Plane(normal(), getVertex(0));
 }
 
 std::string Polygon::toString() const
@@ -142,13 +263,12 @@ std::string Polygon::toString() const
     return ss.str();
 }
 
-arma::vec3 Polygon::linePlaneIntersection(const arma::vec3 &line_point_a,
-                                          const arma::vec3 &line_point_b,
-                                          const arma::vec3 &plane_normal,
-                                          const arma::vec3 &plane_point)
+arma::vec3 Polygon::toVec(const Coordinates &c)
 {
-    auto line_direction = line_point_b - line_point_a;    
-    auto t = arma::dot(plane_point - line_point_a, plane_normal)
-             / arma::dot(line_direction, plane_normal);    
-    return line_point_a + t * line_direction;
-}  
+    return {c[0], c[1], c[2]};
+}
+
+Polygon::Coordinates Polygon::toCoordinates(const arma::vec3 &v)
+{
+    return {Scalar(v[0]), Scalar(v[1]), Scalar(v[2])};
+}
@@ -1,6 +1,12 @@
 #pragma once
+#include "plane.hpp"
+#include "scalar.hpp"
+#include "small_vector.hpp"
 #include <armadillo>
 #include <SFML/Graphics/Color.hpp>
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <optional>
 #include <utility>
 #include <string>
@@ -14,6 +20,20 @@ public:
     using Segment = std::pair<arma::vec3, arma::vec3>;
     using Edge = Segment;
 
+    // position of a polygon relative to a plane
+    enum class Side
+    {
+        Front,
+        Back,
+        Coplanar,
+        Spanning
+    };
+
+    // polygons with up to this many vertices keep them inline, without a
+    // heap allocation; covers triangles and quads, also after they are
+    // clipped by a few planes
+    static constexpr std::size_t INLINE_VERTICES = 8;
+
     Polygon(unsigned int n_vertices = 0);
 
     unsigned int nVertices() const;
@@ -25,6 +45,10 @@ public:
     void       setVertex(unsigned int index, const arma::vec3& position);
     arma::vec3 getVertex(unsigned int index) const;
 
+    // all vertex positions as consecutive x, y, z triples, for code that
+    // processes many vertices at once
+    const Scalar* coordinates() const;
+
     Edge getEdge(unsigned int index) const;
 
     void addVertex(const arma::vec3& position);
@@ -32,22 +56,54 @@ public:
     sf::Color getColor() const;
     void      setColor(const sf::Color& color);
 
+    // index of the scene polygon this polygon is a part of, e.g. the
+    // polygon a BSP tree fragment was cut from; kept by clip()
+    std::uint32_t getSourceIndex() const;
+    void          setSourceIndex(std::uint32_t index);
+
+    // vertices closer to a clipping plane than this, or behind it, count as
+    // outside
+    static constexpr Scalar CLIP_TOLERANCE = PLANE_TOLERANCE;
+
+    // returns the part of the polygon in front of the plane
     static Polygon clip(const Polygon&, const arma::vec3& plane_normal_vec,
                         const arma::vec3& plane_point);
+    static Polygon clip(const Polygon&, const Plane& plane);
+
+    // uses the same tolerance as clip(), so a polygon classified as Front or
+    // Back is left whole by clipping against the plane
+    Side classify(const arma::vec3& plane_normal,
+                  const arma::vec3& plane_point) const;
+    Side classify(const Plane& plane) const;
 
     bool isCoplanar(const Polygon&) const;
 
     arma::vec3 normal() const;
 
+    // true if `point` lies in front of the polygon, i.e. on the side its
+    // normal points to (the side from which the vertices appear in
+    // counter-clockwise order)
+    bool facesPoint(const arma::vec3& point) const;
+
+    // plane the polygon lies on, facing the same way as normal()
+    Plane plane() const;
+
     // for debugging only
     std::string toString() const;
 
 private:
 
-    static arma::vec3 linePlaneIntersection(
-        const arma::vec3& line_point_a, const arma::vec3& line_point_b,
-        const arma::vec3& plane_normal, const arma::vec3& plane_point);
+    // plain coordinates rather than arma::vec3, which is several times
+    // larger than the three numbers it holds
+    using Coordinates = std::array<Scalar, 3>;
+
+    static arma::vec3  toVec(const Coordinates& c);
+    static Coordinates toCoordinates(const arma::vec3& v);
+
+    // normal by Newell's method, not normalised
+    std::array<double, 3> newellNormal() const;
 
-    std::vector<arma::vec3> vertices_;
-    sf::Color               color_;
+    SmallVector<Coordinates, INLINE_VERTICES> vertices_;
+    sf::Color                                 color_;
+    std::uint32_t                             sourceIndex_ = 0;
 };
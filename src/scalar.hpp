@@ -0,0 +1,16 @@
+#pragma once
+#include <type_traits>
+
+// floating point type of the stored geometry (polygon vertices, planes,
+// bounding boxes) and of the clipping and projection arithmetic; double
+// unless the build defines PERSPECTIVE_PROJECTION_SINGLE_PRECISION
+#ifdef PERSPECTIVE_PROJECTION_SINGLE_PRECISION
+using Scalar = float;
+#else
+using Scalar = double;
+#endif
+
+// points closer to a plane than this count as lying on it; single precision
+// keeps only about seven significant digits, so it needs a wider margin
+constexpr Scalar PLANE_TOLERANCE =
+        std::is_same_v<Scalar, float> ? Scalar(1e-4) : Scalar(1e-6);
@@ -2,48 +2,92 @@
 #include "polygon.hpp"
 #include "bsp_tree.hpp"
 #include "object.hpp"
+#include "object_bsp_trees.hpp"
 #include "camera.hpp"
+#include "software_rasterizer.hpp"
+#include "task_pool.hpp"
 #include <SFML/Graphics/RenderTarget.hpp>
 #include <SFML/Graphics/RenderStates.hpp>
 #include <SFML/Graphics/VertexArray.hpp>
 #include <SFML/Graphics/Color.hpp>
+#include <SFML/Graphics/Sprite.hpp>
+#include <SFML/Graphics/Texture.hpp>
+#include <SFML/Graphics/Vertex.hpp>
 #include <armadillo>
+#include <algorithm>
+#include <chrono>
 #include <cstddef>
+#include <filesystem>
+#include <future>
+#include <numeric>
+#include <stdexcept>
 #include <vector>
 
+namespace
+{
+    // frames with fewer polygons are projected on the drawing thread, as
+    // splitting them into tasks costs more than it saves; so are all frames
+    // when the pool has no workers to share the work with
+    constexpr std::size_t MIN_PARALLEL_PROJECTION_POLYGONS = 4096;
+}
+
 const Object& Scene::getObject(std::size_t index) const
 {
     return objects_.at(index);
 }
 
-Object &Scene::getObject(std::size_t index)
+Scene::ObjectEdit Scene::editObject(std::size_t index)
 {
-    treeNeedsRebuilding_ = true;
-    return objects_.at(index);
+    if (index >= objects_.size())
+    {
+        throw std::out_of_range("Scene object index out of range");
+    }
+    return ObjectEdit(*this, index);
 }
 
 void Scene::setObject(std::size_t index, const Object& object)
 {
-    treeNeedsRebuilding_ = true;
+    invalidatePolygons();
     objects_.at(index) = object;
+    objectTrees_.invalidate();
 }
 
 void Scene::addObject(const Object& object)
 {
-    treeNeedsRebuilding_ = true;
+    invalidatePolygons();
     objects_.emplace_back(object);
+    dynamicObjects_.push_back(false);
+    objectTrees_.invalidate();
 }
 
 void Scene::addObject(Object&& object)
 {
-    treeNeedsRebuilding_ = true;
+    invalidatePolygons();
     objects_.emplace_back(object);
+    dynamicObjects_.push_back(false);
+    objectTrees_.invalidate();
 }
 
 void Scene::removeObject(std::size_t index)
 {
-    treeNeedsRebuilding_ = true;
+    invalidatePolygons();
     objects_.erase(objects_.begin() + index);
+    dynamicObjects_.erase(dynamicObjects_.begin() + index);
+    objectTrees_.invalidate();
+}
+
+bool Scene::isDynamic(std::size_t index) const
+{
+    return dynamicObjects_.at(index);
+}
+
+void Scene::setDynamic(std::size_t index, bool dynamic)
+{
+    if (dynamicObjects_.at(index) != dynamic)
+    {
+        invalidatePolygons();
+        dynamicObjects_[index] = dynamic;
+    }
 }
 
 Camera& Scene::camera()
@@ -61,18 +105,321 @@ void Scene::setColorPolygonsByDrawingOrder(bool enabled)
     bspDebugPolygonColoring_ = enabled;
 }
 
-void Scene::rebuildBSPTree() const
+bool Scene::backFaceCulling() const
+{
+    return backFaceCulling_;
+}
+
+void Scene::setBackFaceCulling(bool enabled)
+{
+    backFaceCulling_ = enabled;
+}
+
+bool Scene::batchedDrawing() const
+{
+    return batchedDrawing_;
+}
+
+void Scene::setBatchedDrawing(bool enabled)
+{
+    batchedDrawing_ = enabled;
+}
+
+bool Scene::parallelProjection() const
+{
+    return parallelProjection_;
+}
+
+void Scene::setParallelProjection(bool enabled)
+{
+    parallelProjection_ = enabled;
+}
+
+bool Scene::softwareRendering() const
+{
+    return softwareRendering_;
+}
+
+void Scene::setSoftwareRendering(bool enabled)
+{
+    softwareRendering_ = enabled;
+}
+
+bool Scene::perObjectTrees() const
+{
+    return perObjectTrees_;
+}
+
+void Scene::setPerObjectTrees(bool enabled)
+{
+    perObjectTrees_ = enabled;
+    if (!enabled)
+    {
+        objectTrees_.clear();
+    }
+}
+
+std::vector<Polygon> Scene::polygons() const
 {
     std::vector<Polygon> all_polygons;
     for (auto& obj : objects_)
     {
-        for (auto i = 0u; i < obj.nPolygons(); ++i)
+        obj.appendPolygons(all_polygons);
+    }
+    return all_polygons;
+}
+
+std::vector<Polygon> Scene::staticPolygons() const
+{
+    std::vector<Polygon> static_polygons;
+    for (std::size_t i = 0; i < objects_.size(); ++i)
+    {
+        if (!dynamicObjects_[i])
+        {
+            objects_[i].appendPolygons(static_polygons);
+        }
+    }
+    return static_polygons;
+}
+
+void Scene::rebuildBSPTree() const
+{
+    // a rebuild still running is of older objects
+    retireAsyncRebuild();
+    bspTree_ = BSPTree(staticPolygons());
+    traversalCache_.clear();
+}
+
+bool Scene::asyncRebuild() const
+{
+    return asyncRebuild_;
+}
+
+void Scene::setAsyncRebuild(bool enabled)
+{
+    asyncRebuild_ = enabled;
+}
+
+unsigned int Scene::maxStaleFrames() const
+{
+    return maxStaleFrames_;
+}
+
+void Scene::setMaxStaleFrames(unsigned int n_frames)
+{
+    maxStaleFrames_ = n_frames;
+}
+
+void Scene::loadBSPTree(const std::filesystem::path& file_path)
+{
+    retireAsyncRebuild();
+    bspTree_ = BSPTree::load(file_path, staticPolygons());
+    traversalCache_.clear();
+    treeNeedsRebuilding_ = false;
+}
+
+void Scene::invalidatePolygons()
+{
+    treeNeedsRebuilding_ = true;
+    softwarePolygonsOutdated_ = true;
+}
+
+void Scene::recordEdit(std::size_t object_index, EditKind kind)
+{
+    if (kind == EditKind::Color)
+    {
+        recoloredObjects_.push_back(object_index);
+        objectTrees_.recolorObject(object_index);
+        return;
+    }
+
+    objectTrees_.invalidateObject(object_index);
+    if (dynamicObjects_[object_index])
+    {
+        // placed in the tree's order anew on every frame
+        softwarePolygonsOutdated_ = true;
+    }
+    else
+    {
+        invalidatePolygons();
+    }
+}
+
+void Scene::applyColorEdits() const
+{
+    if (recoloredObjects_.empty())
+    {
+        return;
+    }
+
+    if (treeNeedsRebuilding_ && softwarePolygonsOutdated_)
+    {
+        recoloredObjects_.clear();
+        return;
+    }
+
+    // the polygons of the recolored objects and those between them, by their
+    // index in polygons() and, for the tree, in staticPolygons()
+    auto [first_object, last_object] = std::minmax_element(
+        recoloredObjects_.begin(), recoloredObjects_.end());
+    std::size_t first_polygon = 0;
+    std::size_t first_static_polygon = 0;
+    std::vector<sf::Color> colors;
+    std::vector<sf::Color> static_colors;
+    for (std::size_t i = 0; i <= *last_object; ++i)
+    {
+        const auto& object = objects_[i];
+        bool is_static = !dynamicObjects_[i];
+        if (i < *first_object)
+        {
+            first_polygon += object.nPolygons();
+            first_static_polygon += is_static ? object.nPolygons() : 0;
+            continue;
+        }
+
+        for (std::size_t k = 0; k < object.nPolygons(); ++k)
+        {
+            colors.push_back(object.getPolygonColor(k));
+            if (is_static)
+            {
+                static_colors.push_back(colors.back());
+            }
+        }
+    }
+    recoloredObjects_.clear();
+
+    if (!treeNeedsRebuilding_ && pendingTree_.valid())
+    {
+        pendingTreeNeedsColors_ = true;
+    }
+    else if (!treeNeedsRebuilding_)
+    {
+        bspTree_.setSourceColors(first_static_polygon, static_colors);
+    }
+    if (!softwarePolygonsOutdated_)
+    {
+        for (std::size_t k = 0; k < colors.size(); ++k)
+        {
+            softwarePolygons_[first_polygon + k].setColor(colors[k]);
+        }
+    }
+}
+
+void Scene::updateBSPTree() const
+{
+    // abandoned rebuilds which have finished by now
+    retiredTrees_.erase(std::remove_if(retiredTrees_.begin(), retiredTrees_.end(),
+                                       [](const std::future<BSPTree>& tree)
+    {
+        return tree.wait_for(std::chrono::seconds(0))
+               == std::future_status::ready;
+    }), retiredTrees_.end());
+
+    if (!asyncRebuild_)
+    {
+        if (treeNeedsRebuilding_)
         {
-            all_polygons.push_back(obj.getPolygon(i));
+            rebuildBSPTree();
+            treeNeedsRebuilding_ = false;
         }
+        return;
     }
 
-    bspTree_ = BSPTree(all_polygons);
+    if (treeNeedsRebuilding_ && !pendingTree_.valid())
+    {
+        startAsyncRebuild();
+    }
+
+    if (pendingTree_.valid())
+    {
+        bool ready = pendingTree_.wait_for(std::chrono::seconds(0))
+                     == std::future_status::ready;
+        if (ready || staleFrames_ >= maxStaleFrames_)
+        {
+            finishAsyncRebuild();
+        }
+    }
+
+    // edits made while the swapped in tree was built
+    if (treeNeedsRebuilding_ && !pendingTree_.valid())
+    {
+        startAsyncRebuild();
+    }
+
+    if (pendingTree_.valid())
+    {
+        ++staleFrames_;
+    }
+    else
+    {
+        staleFrames_ = 0;
+    }
+}
+
+void Scene::retireAsyncRebuild() const
+{
+    // the future of std::async() waits for the rebuild when destroyed, so it
+    // is kept until the rebuild has finished rather than dropped
+    if (pendingTree_.valid())
+    {
+        retiredTrees_.push_back(std::move(pendingTree_));
+    }
+}
+
+void Scene::startAsyncRebuild() const
+{
+    // objects share their meshes, so copying them is cheap; edits made to
+    // them in the meantime copy a shared mesh before changing it
+    //
+    // the tree is built by the rebuild thread alone: its tasks would
+    // otherwise be run by the drawing thread too while it waits for its own
+    // tasks, stalling the frames the rebuild is meant to keep smooth
+    std::vector<Object> static_objects;
+    for (std::size_t i = 0; i < objects_.size(); ++i)
+    {
+        if (!dynamicObjects_[i])
+        {
+            static_objects.push_back(objects_[i]);
+        }
+    }
+
+    pendingTree_ = std::async(std::launch::async,
+                              [objects = std::move(static_objects)]
+    {
+        std::vector<Polygon> all_polygons;
+        for (const auto& obj : objects)
+        {
+            obj.appendPolygons(all_polygons);
+        }
+        BSPTree::BuildOptions options;
+        options.parallel = false;
+        return BSPTree(all_polygons, options);
+    });
+    treeNeedsRebuilding_ = false;
+    pendingTreeNeedsColors_ = false;
+}
+
+void Scene::finishAsyncRebuild() const
+{
+    bspTree_ = pendingTree_.get();
+    traversalCache_.clear();
+
+    if (pendingTreeNeedsColors_ && !treeNeedsRebuilding_)
+    {
+        std::vector<sf::Color> colors;
+        for (std::size_t i = 0; i < objects_.size(); ++i)
+        {
+            for (std::size_t k = 0; k < objects_[i].nPolygons(); ++k)
+            {
+                if (!dynamicObjects_[i])
+                {
+                    colors.push_back(objects_[i].getPolygonColor(k));
+                }
+            }
+        }
+        bspTree_.setSourceColors(0, colors);
+    }
+    pendingTreeNeedsColors_ = false;
 }
 
 sf::Color Scene::debugColorMap(std::size_t polygon_index, std::size_t n_polygons)
@@ -112,13 +459,81 @@ sf::Color Scene::debugColorMap(std::size_t polygon_index, std::size_t n_polygons
 
 void Scene::draw(sf::RenderTarget& target, sf::RenderStates states) const
 {
-    if (treeNeedsRebuilding_)
+    applyColorEdits();
+
+    if (softwareRendering_)
     {
-        rebuildBSPTree();
-        treeNeedsRebuilding_ = false;
+        drawSoftware(target, states);
+        return;
     }
-    
-    auto sorted_polygons = bspTree_.depthSortedPolygons(camera_.getPosition());
+
+    std::vector<const Polygon*> sorted_polygons;
+    if (perObjectTrees_)
+    {
+        objectTrees_.update(objects_);
+        sorted_polygons = objectTrees_.depthSortedPolygons(camera_.getPosition(),
+                                                           camera_.frustum());
+    }
+    else
+    {
+        updateBSPTree();
+
+        dynamicPolygons_.clear();
+        for (std::size_t i = 0; i < objects_.size(); ++i)
+        {
+            if (dynamicObjects_[i])
+            {
+                objects_[i].appendPolygons(dynamicPolygons_);
+            }
+        }
+
+        sorted_polygons = bspTree_.depthSortedPolygons(camera_.getPosition(),
+                                                       camera_.frustum(),
+                                                       dynamicPolygons_,
+                                                       traversalCache_);
+    }
+
+    if (backFaceCulling_)
+    {
+        auto observer = camera_.getPosition();
+        auto is_back_face = [&](const Polygon* p)
+        {
+            return !p->facesPoint(observer);
+        };
+        sorted_polygons.erase(std::remove_if(sorted_polygons.begin(),
+                                             sorted_polygons.end(),
+                                             is_back_face),
+                              sorted_polygons.end());
+    }
+
+    if (batchedDrawing_ && parallelProjection_
+        && sorted_polygons.size() >= MIN_PARALLEL_PROJECTION_POLYGONS
+        && TaskPool::global().nWorkers() > 0)
+    {
+        batch_.setPrimitiveType(camera_.batchPrimitiveType());
+        projectBatchParallel(sorted_polygons);
+        target.draw(batch_, states);
+        return;
+    }
+
+    if (batchedDrawing_)
+    {
+        batch_.clear();
+        batch_.setPrimitiveType(camera_.batchPrimitiveType());
+
+        for (std::size_t i = 0; i < sorted_polygons.size(); ++i)
+        {
+            const auto& polygon = *sorted_polygons[i];
+            auto color = bspDebugPolygonColoring_ 
+                         ? debugColorMap(i, sorted_polygons.size()) 
+                         : polygon.getColor();
+            camera_.appendProjection(polygon, color, batch_);
+        }
+
+        target.draw(batch_, states);
+        return;
+    }
+
     for (std::size_t i = 0; i < sorted_polygons.size(); ++i)
     {
         if (bspDebugPolygonColoring_)
@@ -133,3 +548,148 @@ void Scene::draw(sf::RenderTarget& target, sf::RenderStates states) const
         }
     }
 }
+
+void Scene::projectBatchParallel(const std::vector<const Polygon*>& polygons) const
+{
+    auto n_polygons = polygons.size();
+    clippedPolygons_.resize(n_polygons);
+    batchOffsets_.resize(n_polygons + 1);
+    batchOffsets_[0] = 0;
+
+    auto& pool = TaskPool::global();
+    std::size_t n_chunks = std::min<std::size_t>(4 * (pool.nWorkers() + 1),
+                                                 n_polygons);
+    auto chunk_begin = [&](std::size_t chunk)
+    {
+        return n_polygons * chunk / n_chunks;
+    };
+
+    // every polygon is clipped once, its vertex count in the batch is kept
+    // in the entry after its own to be turned into offsets
+    TaskPool::TaskGroup group(pool);
+    for (std::size_t chunk = 0; chunk < n_chunks; ++chunk)
+    {
+        group.run([&, chunk]
+        {
+            auto frustum = camera_.frustum();
+            for (auto i = chunk_begin(chunk); i < chunk_begin(chunk + 1); ++i)
+            {
+                clippedPolygons_[i] = frustum.clip(*polygons[i]);
+                batchOffsets_[i + 1] = camera_.nProjectionVertices(
+                    clippedPolygons_[i].nVertices());
+            }
+        });
+    }
+    group.wait();
+
+    std::partial_sum(batchOffsets_.begin(), batchOffsets_.end(),
+                     batchOffsets_.begin());
+
+    batch_.resize(batchOffsets_.back());
+    for (std::size_t chunk = 0; chunk < n_chunks; ++chunk)
+    {
+        group.run([&, chunk]
+        {
+            for (auto i = chunk_begin(chunk); i < chunk_begin(chunk + 1); ++i)
+            {
+                if (batchOffsets_[i] == batchOffsets_[i + 1])
+                {
+                    continue;
+                }
+                auto color = bspDebugPolygonColoring_
+                             ? debugColorMap(i, n_polygons)
+                             : polygons[i]->getColor();
+                camera_.writeProjection(clippedPolygons_[i], color,
+                                        &batch_[batchOffsets_[i]]);
+            }
+        });
+    }
+    group.wait();
+}
+
+void Scene::drawSoftware(sf::RenderTarget& target, sf::RenderStates states) const
+{
+    if (softwarePolygonsOutdated_)
+    {
+        softwarePolygons_ = polygons();
+        softwarePolygonsOutdated_ = false;
+    }
+
+    auto observer = camera_.getPosition();
+    std::vector<const Polygon*> visible_polygons;
+    visible_polygons.reserve(softwarePolygons_.size());
+    for (const auto& polygon : softwarePolygons_)
+    {
+        if (!backFaceCulling_ || polygon.facesPoint(observer))
+        {
+            visible_polygons.push_back(&polygon);
+        }
+    }
+
+    rasterizer_.render(visible_polygons, camera_);
+
+    const auto& frame = rasterizer_.framebuffer();
+    auto size = rasterTexture_.getSize();
+    if (size.x != frame.width || size.y != frame.height)
+    {
+        rasterTexture_.create(frame.width, frame.height);
+    }
+    rasterTexture_.update(frame.pixels.data());
+
+    target.draw(sf::Sprite(rasterTexture_), states);
+}
+
+Scene::ObjectEdit::ObjectEdit(Scene& scene, std::size_t index) :
+    scene_(scene),
+    index_(index)
+{
+}
+
+const Object& Scene::ObjectEdit::object() const
+{
+    return scene_.objects_[index_];
+}
+
+void Scene::ObjectEdit::setColor(const sf::Color& color)
+{
+    target(EditKind::Color).setColor(color);
+}
+
+void Scene::ObjectEdit::setPolygonColor(std::size_t index, const sf::Color& color)
+{
+    target(EditKind::Color).setPolygonColor(index, color);
+}
+
+void Scene::ObjectEdit::setTransform(const Transform& transform)
+{
+    target(EditKind::Transform).setTransform(transform);
+}
+
+void Scene::ObjectEdit::setOrigin(const arma::vec3& origin)
+{
+    target(EditKind::Transform).setOrigin(origin);
+}
+
+void Scene::ObjectEdit::setPolygon(std::size_t index, const Polygon& polygon)
+{
+    auto& object = scene_.objects_[index_];
+    bool vertices_changed = object.setPolygon(index, polygon);
+    scene_.recordEdit(index_, vertices_changed ? EditKind::Topology
+                                               : EditKind::Color);
+}
+
+void Scene::ObjectEdit::addPolygon(const Polygon& polygon)
+{
+    target(EditKind::Topology).addPolygon(polygon);
+}
+
+Object& Scene::ObjectEdit::modify()
+{
+    return target(EditKind::Topology);
+}
+
+Object& Scene::ObjectEdit::target(EditKind kind)
+{
+    scene_.recordEdit(index_, kind);
+    return scene_.objects_[index_];
+}
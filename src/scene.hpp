@@ -2,9 +2,18 @@
 #include "object.hpp"
 #include "camera.hpp"
 #include "bsp_tree.hpp"
+#include "object_bsp_trees.hpp"
+#include "polygon.hpp"
+#include "software_rasterizer.hpp"
+#include "transform.hpp"
 #include <SFML/Graphics/Drawable.hpp>
 #include <SFML/Graphics/RenderStates.hpp>
 #include <SFML/Graphics/Color.hpp>
+#include <SFML/Graphics/Texture.hpp>
+#include <SFML/Graphics/VertexArray.hpp>
+#include <armadillo>
+#include <filesystem>
+#include <future>
 #include <vector>
 #include <cstddef>
 
@@ -18,10 +27,56 @@ class Scene : public sf::Drawable
 {
 public:
 
+    // what an edit of an object changed, from the cheapest to bring the
+    // scene up to date after: colors only are written to the polygons in
+    // place, transforms and topology (the polygons or vertices themselves)
+    // make the BSP tree be rebuilt
+    enum class EditKind
+    {
+        Color,
+        Transform,
+        Topology
+    };
+
+    // handle through which one object of the scene is changed, recording
+    // the kind of every change; edits made between two frames are applied
+    // together when the next frame is drawn, with at most one rebuild of
+    // the tree for all of them
+    class ObjectEdit
+    {
+    public:
+
+        const Object& object() const;
+
+        void setColor(const sf::Color& color);
+        void setPolygonColor(std::size_t index, const sf::Color& color);
+
+        void setTransform(const Transform& transform);
+        void setOrigin(const arma::vec3& origin);
+
+        // a color edit if the polygon has the vertices of the face
+        void setPolygon(std::size_t index, const Polygon& polygon);
+        void addPolygon(const Polygon& polygon);
+
+        // any other change, recorded as a topology edit
+        Object& modify();
+
+    private:
+
+        friend class Scene;
+
+        ObjectEdit(Scene& scene, std::size_t index);
+
+        Object& target(EditKind kind);
+
+        Scene&      scene_;
+        std::size_t index_;
+    };
+
     Scene() = default;
 
     const Object& getObject(std::size_t index) const;
-    Object&       getObject(std::size_t index);
+    ObjectEdit    editObject(std::size_t index);
     void          setObject(std::size_t index, const Object&);
     void          addObject(const Object&);
     void          addObject(Object&&);
@@ -32,17 +87,133 @@ public:
     bool colorPolygonsByDrawingOrder() const;
     void setColorPolygonsByDrawingOrder(bool enabled);
 
+    // skip polygons facing away from the camera; only correct for closed
+    // meshes whose faces are wound counter-clockwise when seen from outside
+    bool backFaceCulling() const;
+    void setBackFaceCulling(bool enabled);
+
+    // submit all polygons of a frame in one vertex array with a single draw
+    // call, instead of one draw call per polygon
+    bool batchedDrawing() const;
+    void setBatchedDrawing(bool enabled);
+
+    // with batched drawing, clip and project the polygons of large frames in
+    // parallel tasks of TaskPool::global(); the batch is the same as when
+    // built on one thread
+    bool parallelProjection() const;
+    void setParallelProjection(bool enabled);
+
+    // draw with SoftwareRasterizer, which sorts out visibility with a depth
+    // buffer instead of the BSP tree, so the tree is not built or traversed;
+    // wireframe mode and coloring by drawing order do not apply
+    bool softwareRendering() const;
+    void setSoftwareRendering(bool enabled);
+
+    // dynamic objects, e.g. moving ones, are left out of the BSP tree and
+    // placed in its order on every frame instead (see
+    // BSPTree::depthSortedPolygons()), so that editing them does not make the
+    // tree be rebuilt; objects are static when added
+    bool isDynamic(std::size_t index) const;
+    void setDynamic(std::size_t index, bool dynamic);
+
+    // order the polygons with a BSP tree per mesh, built in the mesh's own
+    // coordinates, and the objects by planes separating them (see
+    // ObjectBSPTrees) instead of with one tree of the whole scene; moving
+    // an object then rebuilds no tree unless it overlaps others. The tree of
+    // the scene is not used, so the dynamic objects, asynchronous rebuilds
+    // and loadBSPTree() do not apply.
+    bool perObjectTrees() const;
+    void setPerObjectTrees(bool enabled);
+
+    // polygons of all objects in order
+    std::vector<Polygon> polygons() const;
+
+    // polygons of the static objects in order, the input of the BSP tree
+    std::vector<Polygon> staticPolygons() const;
+
     void rebuildBSPTree() const;
 
+    // rebuild the BSP tree after edits on a separate thread, from a copy of
+    // the objects taken when the rebuild starts, and keep drawing with the
+    // previous tree until the new one is ready
+    bool asyncRebuild() const;
+    void setAsyncRebuild(bool enabled);
+
+    // frames that may be drawn with a tree older than the objects before
+    // drawing waits for the rebuild to finish; with 0 every frame shows the
+    // current objects, still built on the other thread
+    unsigned int maxStaleFrames() const;
+    void         setMaxStaleFrames(unsigned int n_frames);
+
+    // uses a tree saved by BSPTree::save() for staticPolygons() instead of
+    // building it on the next draw, see perspective-projection-bsp-compiler
+    // may throw std::runtime_error if the file cannot be read or was saved
+    // for a different scene
+    void loadBSPTree(const std::filesystem::path& file_path);
+
 private:
 
     static sf::Color debugColorMap(std::size_t polygon_index, std::size_t n_polygons);
 
     virtual void draw(sf::RenderTarget& target, sf::RenderStates states) const override;
+    void drawSoftware(sf::RenderTarget& target, sf::RenderStates states) const;
+
+    // fills batch_ with the projections of the polygons, in order
+    void projectBatchParallel(const std::vector<const Polygon*>& polygons) const;
+
+    // marks both the BSP tree and the polygons kept for software rendering
+    // as out of date
+    void invalidatePolygons();
+
+    void recordEdit(std::size_t object_index, EditKind kind);
+
+    // rebuilds the tree if it is outdated, or in asynchronous mode starts a
+    // rebuild and swaps in a finished one
+    void updateBSPTree() const;
+    void startAsyncRebuild() const;
+    void finishAsyncRebuild() const;
+
+    // abandons the running rebuild, if any, without waiting for it
+    void retireAsyncRebuild() const;
+
+    // writes the colors of the recolored objects to the polygons of the
+    // tree and those kept for software rendering, unless they are rebuilt
+    void applyColorEdits() const;
 
     std::vector<Object> objects_;
+    std::vector<bool>   dynamicObjects_; // per object
     Camera              camera_;
     mutable BSPTree     bspTree_;
+    mutable BSPTree::TraversalCache traversalCache_; // order of the last frame
+    bool                perObjectTrees_ = false;
+    mutable ObjectBSPTrees objectTrees_;
     mutable bool        treeNeedsRebuilding_ = false;
+    mutable std::vector<std::size_t> recoloredObjects_; // since the last frame
+
+    bool                             asyncRebuild_ = false;
+    unsigned int                     maxStaleFrames_ = 4;
+    mutable std::future<BSPTree>     pendingTree_; // valid while rebuilding
+
+    // abandoned rebuilds still running, waited for only by the destructor
+    mutable std::vector<std::future<BSPTree>> retiredTrees_;
+    mutable unsigned int             staleFrames_ = 0;
+
+    // colors were edited after the objects of the pending tree were copied
+    mutable bool                     pendingTreeNeedsColors_ = false;
     bool                bspDebugPolygonColoring_ = false;
+    bool                backFaceCulling_ = false;
+    bool                batchedDrawing_ = true;
+    bool                parallelProjection_ = true;
+    mutable sf::VertexArray batch_; // reused between frames to keep its memory
+    mutable std::vector<Polygon> dynamicPolygons_; // of the current frame
+
+    // per polygon of the frame, reused by projectBatchParallel()
+    mutable std::vector<Polygon>     clippedPolygons_;
+    mutable std::vector<std::size_t> batchOffsets_;
+
+    bool                         softwareRendering_ = false;
+    mutable std::vector<Polygon> softwarePolygons_; // polygons() of the scene
+    mutable bool                 softwarePolygonsOutdated_ = true;
+    mutable SoftwareRasterizer   rasterizer_;
+    mutable sf::Texture          rasterTexture_;
 };
@@ -0,0 +1,156 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+// contiguous container that stores up to `N` elements inline and only uses
+// a heap allocation when it grows larger than that; meant for small
+// trivially copyable elements
+template <typename T, std::size_t N>
+class SmallVector
+{
+    static_assert(std::is_trivially_copyable_v<T>,
+                  "SmallVector elements must be trivially copyable");
+
+public:
+
+    SmallVector() = default;
+
+    // `size` value-initialized elements
+    explicit SmallVector(std::size_t size)
+    {
+        resize(size);
+    }
+
+    SmallVector(const SmallVector& other)
+    {
+        *this = other;
+    }
+
+    SmallVector(SmallVector&& other) noexcept
+    {
+        *this = std::move(other);
+    }
+
+    SmallVector& operator=(const SmallVector& other)
+    {
+        if (this != &other)
+        {
+            size_ = 0;
+            reserve(other.size_);
+            std::copy(other.begin(), other.end(), data());
+            size_ = other.size_;
+        }
+        return *this;
+    }
+
+    SmallVector& operator=(SmallVector&& other) noexcept
+    {
+        if (this == &other)
+        {
+            return *this;
+        }
+
+        if (other.heap_)
+        {
+            heap_ = std::move(other.heap_);
+            capacity_ = other.capacity_;
+        }
+        else
+        {
+            heap_.reset();
+            capacity_ = N;
+            std::copy(other.begin(), other.end(), inline_);
+        }
+
+        size_ = other.size_;
+        other.size_ = 0;
+        other.capacity_ = N;
+        return *this;
+    }
+
+    std::size_t size() const { return size_; }
+    std::size_t capacity() const { return capacity_; }
+    bool        empty() const { return size_ == 0; }
+
+    T*       data() { return heap_ ? heap_.get() : inline_; }
+    const T* data() const { return heap_ ? heap_.get() : inline_; }
+
+    T*       begin() { return data(); }
+    T*       end() { return data() + size_; }
+    const T* begin() const { return data(); }
+    const T* end() const { return data() + size_; }
+
+    T&       operator[](std::size_t index) { return data()[index]; }
+    const T& operator[](std::size_t index) const { return data()[index]; }
+
+    T& at(std::size_t index)
+    {
+        checkIndex(index);
+        return data()[index];
+    }
+
+    const T& at(std::size_t index) const
+    {
+        checkIndex(index);
+        return data()[index];
+    }
+
+    void reserve(std::size_t capacity)
+    {
+        if (capacity <= capacity_)
+        {
+            return;
+        }
+
+        auto heap = std::make_unique<T[]>(capacity);
+        std::copy(begin(), end(), heap.get());
+        heap_ = std::move(heap);
+        capacity_ = capacity;
+    }
+
+    void resize(std::size_t size)
+    {
+        reserve(size);
+        std::fill(data() + std::min(size, size_), data() + size, T{});
+        size_ = size;
+    }
+
+    void push_back(const T& value)
+    {
+        if (size_ == capacity_)
+        {
+            // `value` might refer to an element of this vector
+            T copy = value;
+            reserve(2 * capacity_);
+            data()[size_++] = copy;
+        }
+        else
+        {
+            data()[size_++] = value;
+        }
+    }
+
+    void clear()
+    {
+        size_ = 0;
+    }
+
+private:
+
+    void checkIndex(std::size_t index) const
+    {
+        if (index >= size_)
+        {
+            throw std::out_of_range("SmallVector index out of range");
+        }
+    }
+
+    std::size_t          size_     = 0;
+    std::size_t          capacity_ = N;
+    std::unique_ptr<T[]> heap_;
+    T                    inline_[N];
+};
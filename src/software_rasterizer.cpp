@@ -0,0 +1,323 @@
+#include "software_rasterizer.hpp"
+#include "camera.hpp"
+#include "frustum.hpp"
+#include "polygon.hpp"
+#include "task_pool.hpp"
+#include <SFML/Graphics/Image.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <vector>
+
+namespace
+{
+    // polygons set up by one task at least, so that small scenes are not
+    // split into tasks costing more than the work they do
+    constexpr std::size_t MIN_BATCH_POLYGONS = 256;
+
+    // coefficients of the edge function a * x + b * y + c of the edge from
+    // (x0, y0) to (x1, y1), positive on the side of the triangle
+    struct EdgeFunction
+    {
+        float a, b, c;
+
+        EdgeFunction(float x0, float y0, float x1, float y1) :
+            a(y0 - y1),
+            b(x1 - x0),
+            c(x0 * y1 - y0 * x1)
+        {
+        }
+
+        float operator()(float x, float y) const
+        {
+            return a * x + b * y + c;
+        }
+    };
+}
+
+bool Framebuffer::saveToFile(const std::filesystem::path& file_path) const
+{
+    sf::Image image;
+    image.create(width, height, pixels.data());
+    return image.saveToFile(file_path.string());
+}
+
+SoftwareRasterizer::SoftwareRasterizer() :
+    SoftwareRasterizer(Options())
+{
+}
+
+SoftwareRasterizer::SoftwareRasterizer(const Options& options) :
+    options_(options)
+{
+    options_.tileSize = std::max(options_.tileSize, 1u);
+}
+
+void SoftwareRasterizer::render(const std::vector<const Polygon*>& polygons,
+                                const Camera& camera)
+{
+    auto dimensions = camera.getImageDimensions();
+    resize(dimensions[0], dimensions[1]);
+
+    auto frustum = camera.frustum();
+    auto& pool = TaskPool::global();
+
+    // consecutive runs of polygons, so that the triangles of every tile stay
+    // in the order the polygons were given in
+    std::size_t n_batches = 1;
+    if (options_.parallel)
+    {
+        std::size_t max_batches = 4 * (pool.nWorkers() + 1);
+        n_batches = std::clamp<std::size_t>(polygons.size() / MIN_BATCH_POLYGONS,
+                                            1, max_batches);
+    }
+    batches_.resize(n_batches);
+
+    auto batch_begin = [&](std::size_t batch)
+    {
+        return polygons.size() * batch / n_batches;
+    };
+    auto set_up = [&](std::size_t batch)
+    {
+        auto begin = batch_begin(batch);
+        setUpBatch(polygons.data() + begin, batch_begin(batch + 1) - begin,
+                   camera, frustum, batches_[batch]);
+    };
+
+    std::size_t n_tiles = std::size_t(nTilesX_) * nTilesY_;
+
+    if (!options_.parallel)
+    {
+        set_up(0);
+        for (std::size_t tile = 0; tile < n_tiles; ++tile)
+        {
+            fillTile(tile);
+        }
+        return;
+    }
+
+    TaskPool::TaskGroup group(pool);
+    for (std::size_t batch = 0; batch < n_batches; ++batch)
+    {
+        group.run([&set_up, batch] { set_up(batch); });
+    }
+    group.wait();
+
+    for (std::size_t tile = 0; tile < n_tiles; ++tile)
+    {
+        group.run([this, tile] { fillTile(tile); });
+    }
+    group.wait();
+}
+
+const Framebuffer& SoftwareRasterizer::framebuffer() const
+{
+    return framebuffer_;
+}
+
+void SoftwareRasterizer::resize(unsigned int width, unsigned int height)
+{
+    if (width == framebuffer_.width && height == framebuffer_.height)
+    {
+        return;
+    }
+
+    framebuffer_.width = width;
+    framebuffer_.height = height;
+    framebuffer_.pixels.resize(std::size_t(width) * height * 4);
+    framebuffer_.inverseDepths.resize(std::size_t(width) * height);
+
+    auto tile_size = options_.tileSize;
+    nTilesX_ = (width + tile_size - 1) / tile_size;
+    nTilesY_ = (height + tile_size - 1) / tile_size;
+}
+
+void SoftwareRasterizer::setUpBatch(const Polygon* const* polygons,
+                                    std::size_t n_polygons,
+                                    const Camera& camera,
+                                    const Frustum& frustum,
+                                    Batch& batch) const
+{
+    batch.triangles.clear();
+    batch.tileTriangles.resize(std::size_t(nTilesX_) * nTilesY_);
+    for (auto& tile_triangles : batch.tileTriangles)
+    {
+        tile_triangles.clear();
+    }
+
+    int last_x = int(framebuffer_.width) - 1;
+    int last_y = int(framebuffer_.height) - 1;
+    int tile_size = int(options_.tileSize);
+
+    for (std::size_t i = 0; i < n_polygons; ++i)
+    {
+        auto clipped = frustum.clip(*polygons[i]);
+        auto n = clipped.nVertices();
+        if (n < 3)
+        {
+            continue;
+        }
+
+        batch.screenPoints.resize(2 * n);
+        batch.depths.resize(n);
+        camera.projectPoints(clipped.coordinates(), n,
+                             batch.screenPoints.data(), batch.depths.data());
+
+        auto color = polygons[i]->getColor();
+
+        // the polygon is convex, so it is a fan of triangles around its
+        // first vertex
+        for (unsigned int j = 2; j < n; ++j)
+        {
+            Triangle triangle;
+            unsigned int vertices[3] = {0, j - 1, j};
+            for (int k = 0; k < 3; ++k)
+            {
+                triangle.x[k] = float(batch.screenPoints[2 * vertices[k]]);
+                triangle.y[k] = float(batch.screenPoints[2 * vertices[k] + 1]);
+                triangle.inverseDepth[k] = float(1 / batch.depths[vertices[k]]);
+            }
+
+            // twice the signed area; polygons are drawn from both sides, so
+            // triangles wound the other way are turned around
+            float area = (triangle.x[1] - triangle.x[0])
+                         * (triangle.y[2] - triangle.y[0])
+                         - (triangle.y[1] - triangle.y[0])
+                           * (triangle.x[2] - triangle.x[0]);
+            if (area == 0)
+            {
+                continue;
+            }
+            if (area < 0)
+            {
+                std::swap(triangle.x[1], triangle.x[2]);
+                std::swap(triangle.y[1], triangle.y[2]);
+                std::swap(triangle.inverseDepth[1], triangle.inverseDepth[2]);
+            }
+
+            auto [min_x, max_x] = std::minmax({triangle.x[0], triangle.x[1],
+                                               triangle.x[2]});
+            auto [min_y, max_y] = std::minmax({triangle.y[0], triangle.y[1],
+                                               triangle.y[2]});
+            triangle.minX = std::max(int(std::floor(min_x)), 0);
+            triangle.minY = std::max(int(std::floor(min_y)), 0);
+            triangle.maxX = std::min(int(std::floor(max_x)), last_x);
+            triangle.maxY = std::min(int(std::floor(max_y)), last_y);
+            if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+            {
+                continue;
+            }
+
+            triangle.color[0] = color.r;
+            triangle.color[1] = color.g;
+            triangle.color[2] = color.b;
+            triangle.color[3] = color.a;
+
+            auto index = std::uint32_t(batch.triangles.size());
+            batch.triangles.push_back(triangle);
+
+            for (int ty = triangle.minY / tile_size;
+                 ty <= triangle.maxY / tile_size; ++ty)
+            {
+                for (int tx = triangle.minX / tile_size;
+                     tx <= triangle.maxX / tile_size; ++tx)
+                {
+                    batch.tileTriangles[std::size_t(ty) * nTilesX_ + tx]
+                        .push_back(index);
+                }
+            }
+        }
+    }
+}
+
+void SoftwareRasterizer::fillTile(std::size_t tile)
+{
+    int tile_size = int(options_.tileSize);
+    int min_x = int(tile % nTilesX_) * tile_size;
+    int min_y = int(tile / nTilesX_) * tile_size;
+    int max_x = std::min(min_x + tile_size, int(framebuffer_.width)) - 1;
+    int max_y = std::min(min_y + tile_size, int(framebuffer_.height)) - 1;
+
+    const auto& background = options_.background;
+    std::uint8_t clear_color[4] = {background.r, background.g, background.b,
+                                   background.a};
+    for (int y = min_y; y <= max_y; ++y)
+    {
+        auto row = std::size_t(y) * framebuffer_.width;
+        for (int x = min_x; x <= max_x; ++x)
+        {
+            std::memcpy(&framebuffer_.pixels[4 * (row + x)], clear_color, 4);
+        }
+        std::fill(framebuffer_.inverseDepths.begin() + row + min_x,
+                  framebuffer_.inverseDepths.begin() + row + max_x + 1, 0.0f);
+    }
+
+    for (const auto& batch : batches_)
+    {
+        for (auto index : batch.tileTriangles[tile])
+        {
+            fillTriangle(batch.triangles[index], min_x, min_y, max_x, max_y);
+        }
+    }
+}
+
+void SoftwareRasterizer::fillTriangle(const Triangle& triangle,
+                                      int min_x, int min_y,
+                                      int max_x, int max_y)
+{
+    const float* x = triangle.x;
+    const float* y = triangle.y;
+
+    // e[k] is zero on the edge opposite to vertex k and equals the doubled
+    // triangle area at vertex k, so e[k] / area are the barycentric
+    // coordinates of a point
+    EdgeFunction e[3] = {EdgeFunction(x[1], y[1], x[2], y[2]),
+                         EdgeFunction(x[2], y[2], x[0], y[0]),
+                         EdgeFunction(x[0], y[0], x[1], y[1])};
+    float inv_area = 1 / e[2](x[2], y[2]);
+
+    // the inverse depth is linear in screen space: z = za * x + zb * y + zc
+    const float* z = triangle.inverseDepth;
+    float za = (z[0] * e[0].a + z[1] * e[1].a + z[2] * e[2].a) * inv_area;
+    float zb = (z[0] * e[0].b + z[1] * e[1].b + z[2] * e[2].b) * inv_area;
+    float zc = (z[0] * e[0].c + z[1] * e[1].c + z[2] * e[2].c) * inv_area;
+
+    min_x = std::max(min_x, triangle.minX);
+    min_y = std::max(min_y, triangle.minY);
+    max_x = std::min(max_x, triangle.maxX);
+    max_y = std::min(max_y, triangle.maxY);
+
+    auto width = std::size_t(framebuffer_.width);
+    auto* pixels = framebuffer_.pixels.data();
+    auto* depths = framebuffer_.inverseDepths.data();
+    bool depth_test = options_.depthTest;
+
+    // pixels are sampled at their centres
+    for (int py = min_y; py <= max_y; ++py)
+    {
+        float sy = py + 0.5f;
+        float sx = min_x + 0.5f;
+        float w0 = e[0](sx, sy);
+        float w1 = e[1](sx, sy);
+        float w2 = e[2](sx, sy);
+        float depth = za * sx + zb * sy + zc;
+        auto row = std::size_t(py) * width;
+
+        for (int px = min_x; px <= max_x; ++px)
+        {
+            if (w0 >= 0 && w1 >= 0 && w2 >= 0
+                && (!depth_test || depth > depths[row + px]))
+            {
+                depths[row + px] = depth;
+                std::memcpy(pixels + 4 * (row + px), triangle.color, 4);
+            }
+            w0 += e[0].a;
+            w1 += e[1].a;
+            w2 += e[2].a;
+            depth += za;
+        }
+    }
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include "camera.hpp"
+#include "polygon.hpp"
+#include <SFML/Graphics/Color.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+// RGBA image with a depth buffer, as written by SoftwareRasterizer
+struct Framebuffer
+{
+    unsigned int width = 0;
+    unsigned int height = 0;
+
+    // red, green, blue and alpha byte of every pixel, rows from the top down;
+    // the layout sf::Texture::update() and sf::Image::create() take
+    std::vector<std::uint8_t> pixels;
+
+    // inverse depth (see Camera::projectPoints()) of the polygon seen at
+    // every pixel, 0 where there is none
+    std::vector<float> inverseDepths;
+
+    // writes the image in the format given by the file extension, see
+    // sf::Image::saveToFile(); returns false if it could not be written
+    bool saveToFile(const std::filesystem::path& file_path) const;
+};
+
+// draws polygons on the CPU, resolving visibility with a depth buffer, so
+// that they can be drawn in any order and without a BSP tree
+//
+// The polygons are clipped, projected and split into triangles in batches,
+// and every triangle is binned to the screen tiles it overlaps. Each tile is
+// then filled by a single task, which owns its part of the framebuffer.
+class SoftwareRasterizer
+{
+public:
+
+    struct Options
+    {
+        // side of the square screen tiles, in pixels
+        unsigned int tileSize = 64;
+
+        // set up triangles and fill tiles as tasks of TaskPool::global();
+        // the image is the same as when drawn on a single thread
+        bool parallel = true;
+
+        sf::Color background = sf::Color::Black;
+
+        // without the depth test every polygon covers those given before it
+        // (painter's algorithm), so polygons have to be given back to front,
+        // e.g. in the order of a BSP tree
+        bool depthTest = true;
+    };
+
+    SoftwareRasterizer();
+    explicit SoftwareRasterizer(const Options& options);
+
+    // draws the polygons as seen by the camera into the framebuffer, which
+    // takes the camera's image dimensions; where polygons overlap at the same
+    // depth, the one given first is seen (the last one without depth test)
+    void render(const std::vector<const Polygon*>& polygons,
+                const Camera& camera);
+
+    const Framebuffer& framebuffer() const;
+
+private:
+
+    // triangle in screen coordinates, its vertices ordered so that the edge
+    // functions in fillTriangle() are positive inside
+    struct Triangle
+    {
+        float         x[3];
+        float         y[3];
+        float         inverseDepth[3];
+        std::uint8_t  color[4];
+
+        // pixels the triangle may cover, inclusive
+        int           minX, minY, maxX, maxY;
+    };
+
+    // triangles made from a run of consecutive polygons, and for every tile
+    // the indices of the triangles overlapping it, in drawing order
+    struct Batch
+    {
+        std::vector<Triangle>                   triangles;
+        std::vector<std::vector<std::uint32_t>> tileTriangles;
+
+        // reused projection buffers
+        std::vector<Scalar>                     screenPoints;
+        std::vector<Scalar>                     depths;
+    };
+
+    void resize(unsigned int width, unsigned int height);
+
+    void setUpBatch(const Polygon* const* polygons, std::size_t n_polygons,
+                    const Camera& camera, const Frustum& frustum,
+                    Batch& batch) const;
+    void fillTile(std::size_t tile);
+    void fillTriangle(const Triangle& triangle, int min_x, int min_y,
+                      int max_x, int max_y);
+
+    Options            options_;
+    Framebuffer        framebuffer_;
+    unsigned int       nTilesX_ = 0;
+    unsigned int       nTilesY_ = 0;
+    std::vector<Batch> batches_; // reused between frames to keep their memory
+};
@@ -0,0 +1,223 @@
+#include "task_pool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace
+{
+    // pool the current thread works for and its queue index in that pool
+    thread_local const TaskPool* current_pool = nullptr;
+    thread_local unsigned int    current_worker = 0;
+}
+
+TaskPool::TaskPool(unsigned int n_workers) :
+    nQueued_(0),
+    stopping_(false)
+{
+    for (auto i = 0u; i < n_workers + 1; ++i)
+    {
+        queues_.emplace_back(std::make_unique<TaskQueue>());
+    }
+
+    for (auto i = 0u; i < n_workers; ++i)
+    {
+        workers_.emplace_back([this, i] { workerLoop(i); });
+    }
+}
+
+TaskPool::~TaskPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+        stopping_ = true;
+    }
+    wakeUp_.notify_all();
+
+    for (auto& w : workers_)
+    {
+        w.join();
+    }
+}
+
+unsigned int TaskPool::nWorkers() const
+{
+    return workers_.size();
+}
+
+TaskPool& TaskPool::global()
+{
+    static TaskPool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    return pool;
+}
+
+void TaskPool::push(Task task)
+{
+    auto queue_index = current_pool == this ? current_worker
+                                            : queues_.size() - 1;
+    {
+        auto& queue = *queues_[queue_index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.emplace_back(std::move(task));
+    }
+    nQueued_.fetch_add(1);
+
+    {
+        // makes sure a worker about to sleep sees the new task
+        std::lock_guard<std::mutex> lock(sleepMutex_);
+    }
+    wakeUp_.notify_one();
+}
+
+bool TaskPool::runOneTask()
+{
+    if (nQueued_.load() == 0)
+    {
+        return false;
+    }
+
+    auto n_queues = queues_.size();
+    auto own_index = current_pool == this ? current_worker : n_queues - 1;
+    Task task;
+    bool found = false;
+
+    for (std::size_t i = 0; i < n_queues && !found; ++i)
+    {
+        auto& queue = *queues_[(own_index + i) % n_queues];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty())
+        {
+            continue;
+        }
+
+        if (i == 0)
+        {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+        else
+        {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        found = true;
+    }
+
+    if (!found)
+    {
+        return false;
+    }
+
+    nQueued_.fetch_sub(1);
+
+    std::exception_ptr exception;
+    try
+    {
+        task.function();
+    }
+    catch (...)
+    {
+        exception = std::current_exception();
+    }
+    task.group->finish(exception);
+
+    return true;
+}
+
+void TaskPool::workerLoop(unsigned int worker_index)
+{
+    current_pool = this;
+    current_worker = worker_index;
+
+    while (true)
+    {
+        if (runOneTask())
+        {
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex_);
+        wakeUp_.wait(lock, [this] { return stopping_ || nQueued_.load() > 0; });
+        if (stopping_ && nQueued_.load() == 0)
+        {
+            return;
+        }
+    }
+}
+
+TaskPool::TaskGroup::TaskGroup(TaskPool& pool) :
+    pool_(pool),
+    nPending_(0)
+{}
+
+TaskPool::TaskGroup::~TaskGroup()
+{
+    try
+    {
+        wait();
+    }
+    catch (...)
+    {
+    }
+}
+
+void TaskPool::TaskGroup::run(std::function<void()> task)
+{
+    nPending_.fetch_add(1);
+    pool_.push({std::move(task), this});
+}
+
+void TaskPool::TaskGroup::wait()
+{
+    while (nPending_.load(std::memory_order_acquire) > 0)
+    {
+        if (pool_.runOneTask())
+        {
+            continue;
+        }
+
+        // the remaining tasks run on other threads; sleep until they are
+        // finished or queue new tasks which this thread can help with
+        std::unique_lock<std::mutex> lock(pool_.sleepMutex_);
+        pool_.wakeUp_.wait(lock, [this]
+        {
+            return nPending_.load(std::memory_order_acquire) == 0
+                   || pool_.nQueued_.load() > 0;
+        });
+    }
+
+    std::lock_guard<std::mutex> lock(exceptionMutex_);
+    if (exception_)
+    {
+        auto exception = std::exchange(exception_, nullptr);
+        std::rethrow_exception(exception);
+    }
+}
+
+void TaskPool::TaskGroup::finish(std::exception_ptr exception)
+{
+    if (exception)
+    {
+        std::lock_guard<std::mutex> lock(exceptionMutex_);
+        if (!exception_)
+        {
+            exception_ = exception;
+        }
+    }
+    // the group may be destroyed as soon as its last task is counted off
+    auto& pool = pool_;
+    if (nPending_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        // wakes a thread waiting for the group, after it checked the count
+        // or once it is waiting
+        {
+            std::lock_guard<std::mutex> lock(pool.sleepMutex_);
+        }
+        pool.wakeUp_.notify_all();
+    }
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// pool of worker threads executing tasks; every worker has its own task queue
+// and idle workers steal tasks from the queues of the other workers
+class TaskPool
+{
+public:
+
+    // creates a pool with `n_workers` worker threads; threads waiting on a
+    // TaskGroup also execute tasks, so a pool with no workers is valid and
+    // runs everything on the waiting thread
+    explicit TaskPool(unsigned int n_workers);
+    ~TaskPool();
+
+    TaskPool(const TaskPool&) = delete;
+    TaskPool& operator=(const TaskPool&) = delete;
+
+    unsigned int nWorkers() const;
+
+    // pool shared by the whole program, with one worker less than there are
+    // hardware threads (the thread that waits for the tasks is the last one)
+    static TaskPool& global();
+
+    // set of tasks which are waited for together
+    class TaskGroup
+    {
+    public:
+
+        explicit TaskGroup(TaskPool& pool);
+
+        // waits for the remaining tasks, exceptions thrown by them are lost
+        ~TaskGroup();
+
+        TaskGroup(const TaskGroup&) = delete;
+        TaskGroup& operator=(const TaskGroup&) = delete;
+
+        void run(std::function<void()> task);
+
+        // blocks until all tasks of the group are finished, executing queued
+        // tasks of the pool in the meantime; rethrows the first exception
+        // thrown by a task of the group
+        void wait();
+
+    private:
+
+        friend class TaskPool;
+
+        void finish(std::exception_ptr exception);
+
+        TaskPool&                pool_;
+        std::atomic<std::size_t> nPending_;
+        std::mutex               exceptionMutex_;
+        std::exception_ptr       exception_;
+    };
+
+private:
+
+    struct Task
+    {
+        std::function<void()> function;
+        TaskGroup*            group;
+    };
+
+    struct TaskQueue
+    {
+        std::mutex       mutex;
+        std::deque<Task> tasks;
+    };
+
+    void push(Task task);
+
+    // runs one queued task, preferring the newest task of the calling
+    // worker's own queue and otherwise stealing the oldest task of another
+    // queue; returns false if there was nothing to run
+    bool runOneTask();
+
+    void workerLoop(unsigned int worker_index);
+
+    // one queue per worker and one shared by all threads outside the pool
+    std::vector<std::unique_ptr<TaskQueue>> queues_;
+    std::vector<std::thread>                workers_;
+    std::atomic<std::size_t>                nQueued_;
+    std::mutex                              sleepMutex_;
+    std::condition_variable                 wakeUp_;
+    bool                                    stopping_;
+};
@@ -0,0 +1,149 @@
+#include "transform.hpp"
+#include <armadillo>
+#include <cmath>
+
+arma::vec3 Transform::getTranslation() const
+{
+    return {translation_[0], translation_[1], translation_[2]};
+}
+
+void Transform::setTranslation(const arma::vec3 &translation)
+{
+    for (auto i = 0u; i < 3; ++i)
+    {
+        translation_[i] = translation[i];
+    }
+}
+
+arma::mat33 Transform::getRotation() const
+{
+    arma::mat33 rotation;
+    for (auto i = 0u; i < 3; ++i)
+    {
+        for (auto j = 0u; j < 3; ++j)
+        {
+            rotation(i, j) = rotation_[i][j];
+        }
+    }
+    return rotation;
+}
+
+void Transform::setRotation(const arma::mat33 &rotation)
+{
+    for (auto i = 0u; i < 3; ++i)
+    {
+        for (auto j = 0u; j < 3; ++j)
+        {
+            rotation_[i][j] = rotation(i, j);
+        }
+    }
+    update();
+}
+
+void Transform::rotate(const arma::vec3 &axis, double angle)
+{
+    // Rodrigues' rotation formula, R = cI + s[k]x + (1 - c)kk^T
+    arma::vec3 k = arma::normalise(axis);
+    double x = k[0], y = k[1], z = k[2];
+    double c = std::cos(angle), s = std::sin(angle), t = 1 - c;
+    double r[3][3] = {
+        {c + t * x * x,     t * x * y - s * z, t * x * z + s * y},
+        {t * x * y + s * z, c + t * y * y,     t * y * z - s * x},
+        {t * x * z - s * y, t * y * z + s * x, c + t * z * z    }
+    };
+
+    double rotated[3][3];
+    for (auto i = 0u; i < 3; ++i)
+    {
+        for (auto j = 0u; j < 3; ++j)
+        {
+            rotated[i][j] = r[i][0] * rotation_[0][j] + r[i][1] * rotation_[1][j]
+                            + r[i][2] * rotation_[2][j];
+        }
+    }
+
+    for (auto i = 0u; i < 3; ++i)
+    {
+        for (auto j = 0u; j < 3; ++j)
+        {
+            rotation_[i][j] = rotated[i][j];
+        }
+    }
+    update();
+}
+
+arma::vec3 Transform::getScale() const
+{
+    return {scale_[0], scale_[1], scale_[2]};
+}
+
+void Transform::setScale(const arma::vec3 &scale)
+{
+    for (auto i = 0u; i < 3; ++i)
+    {
+        scale_[i] = scale[i];
+    }
+    update();
+}
+
+bool Transform::isIdentity() const
+{
+    for (auto i = 0u; i < 3; ++i)
+    {
+        for (auto j = 0u; j < 3; ++j)
+        {
+            if (linear_[i][j] != (i == j ? 1 : 0))
+            {
+                return false;
+            }
+        }
+
+        if (translation_[i] != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+arma::vec3 Transform::apply(const arma::vec3 &point) const
+{
+    auto p = apply(Point{point[0], point[1], point[2]});
+    return {p[0], p[1], p[2]};
+}
+
+Transform::Point Transform::apply(const Point &point) const
+{
+    Point result;
+    for (auto i = 0u; i < 3; ++i)
+    {
+        result[i] = linear_[i][0] * point[0] + linear_[i][1] * point[1]
+                    + linear_[i][2] * point[2] + translation_[i];
+    }
+    return result;
+}
+
+arma::vec3 Transform::applyInverse(const arma::vec3 &point) const
+{
+    // the inverse of the rotation is its transpose
+    double p[3] = {point[0] - translation_[0], point[1] - translation_[1],
+                   point[2] - translation_[2]};
+    arma::vec3 result;
+    for (auto i = 0u; i < 3; ++i)
+    {
+        result[i] = (rotation_[0][i] * p[0] + rotation_[1][i] * p[1]
+                     + rotation_[2][i] * p[2]) / scale_[i];
+    }
+    return result;
+}
+
+void Transform::update()
+{
+    for (auto i = 0u; i < 3; ++i)
+    {
+        for (auto j = 0u; j < 3; ++j)
+        {
+            linear_[i][j] = rotation_[i][j] * scale_[j];
+        }
+    }
+}
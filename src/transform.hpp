@@ -0,0 +1,50 @@
+#pragma once
+#include <armadillo>
+#include <array>
+
+// placement of an object in the scene: the points of its mesh are scaled
+// along the axes, then rotated about the origin, then translated
+class Transform
+{
+public:
+
+    using Point = std::array<double, 3>;
+
+    Transform() = default;
+
+    arma::vec3 getTranslation() const;
+    void       setTranslation(const arma::vec3& translation);
+
+    // rotation matrix, orthonormal with determinant 1
+    arma::mat33 getRotation() const;
+    void        setRotation(const arma::mat33& rotation);
+
+    // rotates by `angle` radians about `axis` (through the origin) after the
+    // current rotation
+    void rotate(const arma::vec3& axis, double angle);
+
+    // scale factors along the x, y and z axes, none of them zero
+    arma::vec3 getScale() const;
+    void       setScale(const arma::vec3& scale);
+
+    bool isIdentity() const;
+
+    arma::vec3 apply(const arma::vec3& point) const;
+    Point      apply(const Point& point) const;
+
+    // the point which apply() maps to `point`
+    arma::vec3 applyInverse(const arma::vec3& point) const;
+
+private:
+
+    // recomputes linear_ from rotation_ and scale_
+    void update();
+
+    double translation_[3] = {0, 0, 0};
+    double rotation_[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+    double scale_[3] = {1, 1, 1};
+
+    // rotation_ * diag(scale_), the part of the transform applied before the
+    // translation
+    double linear_[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+};